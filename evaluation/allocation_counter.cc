@@ -0,0 +1,123 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "allocation_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<size_t> num_allocations(0);
+std::atomic<size_t> allocated_bytes(0);
+std::atomic<size_t> mark(0);
+std::atomic<size_t> num_transient(0);
+
+// Each block starts with the number of its allocation, so that the blocks
+// allocated after the mark can be told apart when they are freed
+union Header {
+  size_t allocation;
+  std::max_align_t align;
+};
+
+void* allocate(size_t size) {
+  size_t allocation = num_allocations.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  Header* header = static_cast<Header*>(std::malloc(sizeof(Header) + size));
+  if (!header) {
+    return nullptr;
+  }
+  header->allocation = allocation;
+  return header + 1;
+}
+
+void deallocate(void* ptr) {
+  if (!ptr) {
+    return;
+  }
+
+  Header* header = static_cast<Header*>(ptr) - 1;
+  if (header->allocation >= mark.load(std::memory_order_relaxed)) {
+    num_transient.fetch_add(1, std::memory_order_relaxed);
+  }
+  std::free(header);
+}
+
+}  // namespace
+
+// The replacements live in their own file, so that the compiler does not pair
+// them with the allocations of other code when inlining. Every form is
+// replaced, since the blocks have a header.
+void* operator new(size_t size) {
+  void* ptr = allocate(size);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return allocate(size);
+}
+
+void operator delete(void* ptr) noexcept {
+  deallocate(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  deallocate(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  deallocate(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  deallocate(ptr);
+}
+
+namespace ibow_lcd {
+
+size_t numAllocations() {
+  return num_allocations.load();
+}
+
+size_t allocatedBytes() {
+  return allocated_bytes.load();
+}
+
+void markAllocations() {
+  mark.store(num_allocations.load());
+  num_transient.store(0);
+}
+
+size_t numTransientAllocations() {
+  return num_transient.load();
+}
+
+}  // namespace ibow_lcd
@@ -0,0 +1,39 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EVALUATION_ALLOCATION_COUNTER_H_
+#define EVALUATION_ALLOCATION_COUNTER_H_
+
+#include <cstddef>
+
+namespace ibow_lcd {
+
+// Heap allocations made by the whole program so far, counted by replacing
+// the global operator new in the evaluator
+size_t numAllocations();
+size_t allocatedBytes();
+
+// Allocations made since the last call to markAllocations() that have been
+// freed already, i.e. the ones that did not outlive the code run meanwhile
+void markAllocations();
+size_t numTransientAllocations();
+
+}  // namespace ibow_lcd
+
+#endif  // EVALUATION_ALLOCATION_COUNTER_H_
@@ -0,0 +1,458 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "benchmarks.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "allocation_counter.h"
+#include "ibow-lcd/geometric_verifier.h"
+#include "ibow-lcd/hamming_matcher.h"
+#include "ibow-lcd/island_builder.h"
+
+namespace ibow_lcd {
+
+namespace {
+
+// Normalizes the scores and keeps the candidates above min_score, as the
+// detector does before building the islands
+void filterCandidates(const std::vector<obindex2::ImageMatch>& image_matches,
+                      const double min_score,
+                      std::vector<obindex2::ImageMatch>* image_matches_filt) {
+  image_matches_filt->clear();
+  if (image_matches.empty()) {
+    return;
+  }
+
+  double max_s = image_matches.front().score;
+  double min_s = image_matches.back().score;
+  for (unsigned i = 0; i < image_matches.size(); i++) {
+    double new_score = (image_matches[i].score - min_s) / (max_s - min_s);
+    if (new_score > min_score) {
+      obindex2::ImageMatch match = image_matches[i];
+      match.score = new_score;
+      image_matches_filt->push_back(match);
+    } else {
+      break;
+    }
+  }
+}
+
+// Island construction checking every island for each candidate, as it was
+// done before IslandBuilder
+void buildIslandsLinear(const std::vector<obindex2::ImageMatch>& image_matches,
+                        const unsigned island_offset,
+                        std::vector<Island>* islands) {
+  islands->clear();
+
+  for (unsigned i = 0; i < image_matches.size(); i++) {
+    unsigned curr_img_id = static_cast<unsigned>(image_matches[i].image_id);
+    double curr_score = image_matches[i].score;
+
+    unsigned min_id = static_cast<unsigned>
+                              (std::max((int)curr_img_id - (int)island_offset,
+                               0));
+    unsigned max_id = curr_img_id + island_offset;
+
+    bool found = false;
+    for (unsigned j = 0; j < islands->size(); j++) {
+      if (islands->at(j).fits(curr_img_id)) {
+        islands->at(j).incrementScore(curr_score);
+        found = true;
+        break;
+      } else {
+        islands->at(j).adjustLimits(curr_img_id, &min_id, &max_id);
+      }
+    }
+
+    if (!found) {
+      islands->push_back(Island(curr_img_id, curr_score, min_id, max_id));
+    }
+  }
+
+  for (unsigned j = 0; j < islands->size(); j++) {
+    islands->at(j).normalizeScore();
+  }
+
+  std::sort(islands->begin(), islands->end());
+}
+
+bool sameIslands(const std::vector<Island>& a, const std::vector<Island>& b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+
+  for (unsigned i = 0; i < a.size(); i++) {
+    if (a[i].min_img_id != b[i].min_img_id ||
+        a[i].max_img_id != b[i].max_img_id ||
+        a[i].img_id != b[i].img_id ||
+        a[i].score != b[i].score) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Queries the images from first on, spread among several reader threads.
+// Each reader does the given number of queries or, if it is 0, queries until
+// stop is set. Returns the total number of queries.
+unsigned runReaders(LCDetector* detector,
+                    const std::vector<std::vector<cv::KeyPoint> >& kps,
+                    const std::vector<cv::Mat>& descs,
+                    const unsigned first,
+                    const unsigned nreaders,
+                    const unsigned nqueries,
+                    const std::atomic<bool>* stop,
+                    unsigned* nloops) {
+  unsigned nimages = descs.size() - first;
+  std::vector<unsigned> done(nreaders, 0);
+  std::vector<unsigned> loops(nreaders, 0);
+  std::vector<std::thread> readers;
+  for (unsigned r = 0; r < nreaders; r++) {
+    readers.push_back(std::thread([&, r]() {
+      LCDetectorResult result;
+      while (nqueries ? done[r] < nqueries : !stop->load()) {
+        unsigned i = first + (r + done[r] * nreaders) % nimages;
+        detector->query(kps[i], descs[i], &result);
+        if (result.isLoop()) {
+          loops[r]++;
+        }
+        done[r]++;
+      }
+    }));
+  }
+
+  unsigned total = 0;
+  *nloops = 0;
+  for (unsigned r = 0; r < nreaders; r++) {
+    readers[r].join();
+    total += done[r];
+    *nloops += loops[r];
+  }
+
+  return total;
+}
+
+}  // namespace
+
+void benchmarkMatchers(const std::vector<cv::Mat>& descs,
+                       const float nndr,
+                       const unsigned npairs,
+                       std::ostream& out) {
+  const BFMatcherType types[] = {BF_MATCHER_OPENCV,
+                                 BF_MATCHER_SCALAR,
+                                 BF_MATCHER_SIMD};
+  const char* names[] = {"OpenCV", "Scalar", hammingKernelName()};
+
+  unsigned nimages = descs.size();
+  unsigned pairs = std::min(npairs, nimages > 0 ? nimages - 1 : 0);
+
+  out << "Benchmarking matchers on " << pairs << " image pairs" << std::endl;
+  std::vector<std::vector<unsigned> > nmatches(3);
+  for (unsigned t = 0; t < 3; t++) {
+    std::vector<cv::DMatch> matches;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < pairs; i++) {
+      ratioMatchHamming(descs[i], descs[i + 1], nndr, types[t], &matches);
+      nmatches[t].push_back(matches.size());
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    // Matchers should agree on the number of matches of each pair
+    unsigned agree = 0;
+    for (unsigned i = 0; i < pairs; i++) {
+      if (nmatches[t][i] == nmatches[0][i]) {
+        agree++;
+      }
+    }
+
+    out << "  " << names[t] << ": " << (pairs ? ms / pairs : 0.0)
+        << " ms/pair, " << agree << "/" << pairs
+        << " pairs agree with OpenCV" << std::endl;
+  }
+}
+
+void benchmarkVerifiers(const std::vector<std::vector<cv::KeyPoint> >& kps,
+                        const std::vector<cv::Mat>& descs,
+                        const LCDetectorParams& params,
+                        const unsigned npairs,
+                        std::ostream& out) {
+  const VerifierType types[] = {VERIFIER_FUNDAMENTAL,
+                                VERIFIER_FUNDAMENTAL_PREEMPTIVE,
+                                VERIFIER_HOMOGRAPHY_PROSAC,
+                                VERIFIER_ESSENTIAL};
+
+  // Building the pairs and their matchings once for all the verifiers
+  unsigned nimages = descs.size();
+  std::vector<std::vector<cv::DMatch> > pair_matches;
+  std::vector<std::pair<unsigned, unsigned> > pairs;
+  for (unsigned i = 0; i + 1 < nimages && pairs.size() < npairs; i++) {
+    unsigned distant = (i + nimages / 2) % nimages;
+    pairs.push_back(std::make_pair(i, i + 1));
+    pairs.push_back(std::make_pair(i, distant));
+  }
+  for (unsigned i = 0; i < pairs.size(); i++) {
+    std::vector<cv::DMatch> matches;
+    ratioMatchHamming(descs[pairs[i].first], descs[pairs[i].second],
+                      params.nndr_bf, BF_MATCHER_OPENCV, &matches);
+    pair_matches.push_back(matches);
+  }
+
+  out << "Benchmarking verifiers on " << pairs.size() << " image pairs"
+      << std::endl;
+  std::vector<char> ref_loops;
+  for (unsigned t = 0; t < 4; t++) {
+    VerifierParams vparams;
+    vparams.type = types[t];
+    vparams.ep_dist = params.ep_dist;
+    vparams.conf_prob = params.conf_prob;
+    vparams.focal_length = params.focal_length;
+    vparams.pp = cv::Point2d(params.pp_x, params.pp_y);
+    if (types[t] == VERIFIER_ESSENTIAL && params.focal_length <= 0.0) {
+      out << "  Essential: skipped, intrinsics unknown" << std::endl;
+      continue;
+    }
+    std::shared_ptr<GeometricVerifier> verifier = createVerifier(vparams);
+
+    double ms = 0.0;
+    unsigned total_inliers = 0;
+    unsigned agree = 0;
+    std::vector<uchar> mask;
+    for (unsigned i = 0; i < pairs.size(); i++) {
+      std::vector<cv::DMatch> matches = pair_matches[i];
+      if (verifier->sortedMatches()) {
+        std::stable_sort(matches.begin(), matches.end());
+      }
+      std::vector<cv::Point2f> query;
+      std::vector<cv::Point2f> train;
+      for (unsigned j = 0; j < matches.size(); j++) {
+        query.push_back(kps[pairs[i].first][matches[j].queryIdx].pt);
+        train.push_back(kps[pairs[i].second][matches[j].trainIdx].pt);
+      }
+
+      auto start = std::chrono::steady_clock::now();
+      unsigned inliers = verifier->countInliers(query, train, &mask);
+      auto end = std::chrono::steady_clock::now();
+      ms += std::chrono::duration<double, std::milli>(end - start).count();
+      total_inliers += inliers;
+
+      // Verifiers should take the same decision as the baseline
+      char loop = inliers > params.min_inliers;
+      if (t == 0) {
+        ref_loops.push_back(loop);
+      }
+      if (loop == ref_loops[i]) {
+        agree++;
+      }
+    }
+
+    unsigned n = pairs.size();
+    out << "  " << verifier->name() << ": " << (n ? ms / n : 0.0)
+        << " ms/pair, " << (n ? total_inliers / n : 0) << " inliers/pair, "
+        << agree << "/" << n << " decisions agree with Fundamental"
+        << std::endl;
+  }
+}
+
+void benchmarkIslands(
+    const std::vector<std::vector<obindex2::ImageMatch> >& candidates,
+    const LCDetectorParams& params,
+    const unsigned repetitions,
+    std::ostream& out) {
+  unsigned island_offset = params.island_size / 2;
+
+  // Filtering the candidates once for both builders
+  std::vector<std::vector<obindex2::ImageMatch> > lists(candidates.size());
+  unsigned ncands = 0;
+  for (unsigned i = 0; i < candidates.size(); i++) {
+    filterCandidates(candidates[i], params.min_score, &lists[i]);
+    ncands += lists[i].size();
+  }
+
+  out << "Benchmarking island construction on " << lists.size()
+      << " queries (" << (lists.empty() ? 0 : ncands / lists.size())
+      << " candidates/query)" << std::endl;
+
+  std::vector<std::vector<Island> > linear(lists.size());
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned r = 0; r < repetitions; r++) {
+    for (unsigned i = 0; i < lists.size(); i++) {
+      buildIslandsLinear(lists[i], island_offset, &linear[i]);
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  double linear_ms =
+                std::chrono::duration<double, std::milli>(end - start).count();
+
+  IslandBuilder builder;
+  std::vector<Island> islands;
+  unsigned agree = 0;
+  start = std::chrono::steady_clock::now();
+  for (unsigned r = 0; r < repetitions; r++) {
+    for (unsigned i = 0; i < lists.size(); i++) {
+      builder.build(lists[i], island_offset, nullptr, &islands);
+      if (r == 0 && sameIslands(islands, linear[i])) {
+        agree++;
+      }
+    }
+  }
+  end = std::chrono::steady_clock::now();
+  double builder_ms =
+                std::chrono::duration<double, std::milli>(end - start).count();
+
+  unsigned n = lists.size() * repetitions;
+  out << "  Linear: " << (n ? linear_ms / n : 0.0) << " ms/query" << std::endl;
+  out << "  IslandBuilder: " << (n ? builder_ms / n : 0.0) << " ms/query, "
+      << agree << "/" << lists.size() << " queries agree with Linear"
+      << std::endl;
+}
+
+void benchmarkQueries(const std::vector<std::vector<cv::KeyPoint> >& kps,
+                      const std::vector<cv::Mat>& descs,
+                      const LCDetectorParams& params,
+                      const unsigned max_readers,
+                      const unsigned nqueries,
+                      std::ostream& out) {
+  unsigned nimages = descs.size();
+  unsigned nindexed = nimages / 2;
+  if (nindexed == 0 || max_readers == 0) {
+    out << "Not enough images or readers to benchmark queries" << std::endl;
+    return;
+  }
+
+  // Indexing the first half of the sequence
+  LCDetector detector(params);
+  LCDetectorResult result;
+  for (unsigned i = 0; i < nindexed; i++) {
+    detector.process(i, kps[i], descs[i], &result);
+  }
+
+  out << "Benchmarking queries on " << nindexed << " indexed images"
+      << std::endl;
+
+  // Readers alone, doubling their number each time
+  double base_qps = 0.0;
+  for (unsigned r = 1; ; r = std::min(r * 2, max_readers)) {
+    unsigned nloops;
+    auto start = std::chrono::steady_clock::now();
+    unsigned total = runReaders(&detector, kps, descs, nindexed, r, nqueries,
+                                nullptr, &nloops);
+    auto end = std::chrono::steady_clock::now();
+    double secs = std::chrono::duration<double>(end - start).count();
+
+    double qps = secs > 0.0 ? total / secs : 0.0;
+    if (r == 1) {
+      base_qps = qps;
+    }
+    out << "  " << r << " readers: " << qps << " queries/s (x"
+        << (base_qps > 0.0 ? qps / base_qps : 0.0) << "), " << nloops << "/"
+        << total << " queries found a loop" << std::endl;
+
+    if (r == max_readers) {
+      break;
+    }
+  }
+
+  // Readers while the rest of the sequence is indexed
+  std::atomic<bool> stop(false);
+  unsigned total = 0;
+  unsigned nloops = 0;
+  std::thread readers([&]() {
+    total = runReaders(&detector, kps, descs, nindexed, max_readers, 0,
+                       &stop, &nloops);
+  });
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = nindexed; i < nimages; i++) {
+    detector.process(i, kps[i], descs[i], &result);
+  }
+  auto end = std::chrono::steady_clock::now();
+  stop = true;
+  readers.join();
+
+  double secs = std::chrono::duration<double>(end - start).count();
+  unsigned nprocessed = nimages - nindexed;
+  out << "  " << max_readers << " readers while indexing: "
+      << (secs > 0.0 ? total / secs : 0.0) << " queries/s, "
+      << (nprocessed ? secs * 1000.0 / nprocessed : 0.0)
+      << " ms/image processed" << std::endl;
+}
+
+void benchmarkAllocations(const std::vector<std::vector<cv::KeyPoint> >& kps,
+                          const std::vector<cv::Mat>& descs,
+                          const LCDetectorParams& params,
+                          std::ostream& out) {
+  unsigned nimages = descs.size();
+  unsigned nwarmup = nimages / 2;
+  if (nwarmup == 0) {
+    out << "Not enough images to benchmark allocations" << std::endl;
+    return;
+  }
+
+  // The frames are built in advance, so their copies are not counted
+  std::vector<FeatureFramePtr> frames(nimages);
+  for (unsigned i = 0; i < nimages; i++) {
+    std::shared_ptr<FeatureFrame> frame = std::make_shared<FeatureFrame>();
+    frame->image_id = i;
+    frame->kps = kps[i];
+    frame->descs = descs[i];
+    frames[i] = frame;
+  }
+
+  unsigned ncounted = nimages - nwarmup;
+  out << "Benchmarking allocations on " << ncounted << " images after "
+      << nwarmup << " images" << std::endl;
+
+  const char* names[] = {"Keypoints", "FeatureFrames"};
+  for (unsigned mode = 0; mode < 2; mode++) {
+    LCDetector detector(params);
+    LCDetectorResult result;
+    size_t count = 0;
+    size_t bytes = 0;
+    for (unsigned i = 0; i < nimages; i++) {
+      if (i == nwarmup) {
+        count = numAllocations();
+        bytes = allocatedBytes();
+        markAllocations();
+      }
+
+      if (mode == 0) {
+        detector.process(i, kps[i], descs[i], &result);
+      } else {
+        detector.process(frames[i], &result);
+      }
+    }
+    count = numAllocations() - count;
+    bytes = allocatedBytes() - bytes;
+
+    // The transient ones are the allocator traffic, the rest is kept
+    out << "  " << names[mode] << ": "
+        << static_cast<double>(count) / ncounted << " allocations/image ("
+        << static_cast<double>(numTransientAllocations()) / ncounted
+        << " freed already), "
+        << static_cast<double>(bytes) / ncounted << " bytes/image"
+        << std::endl;
+  }
+}
+
+}  // namespace ibow_lcd
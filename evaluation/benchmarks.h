@@ -0,0 +1,74 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EVALUATION_BENCHMARKS_H_
+#define EVALUATION_BENCHMARKS_H_
+
+#include <iostream>
+#include <vector>
+
+#include <opencv2/features2d.hpp>
+
+#include "ibow-lcd/lcdetector.h"
+
+namespace ibow_lcd {
+
+// Compares the brute-force matchers on pairs of consecutive images
+void benchmarkMatchers(const std::vector<cv::Mat>& descs,
+                       const float nndr,
+                       const unsigned npairs,
+                       std::ostream& out);
+
+// Compares the geometric verifiers on pairs of consecutive images, which
+// should be accepted, and on pairs of distant images, which usually should not
+void benchmarkVerifiers(const std::vector<std::vector<cv::KeyPoint> >& kps,
+                        const std::vector<cv::Mat>& descs,
+                        const LCDetectorParams& params,
+                        const unsigned npairs,
+                        std::ostream& out);
+
+// Compares the island builder against the former linear construction on
+// recorded candidate lists, as returned by the index
+void benchmarkIslands(
+    const std::vector<std::vector<obindex2::ImageMatch> >& candidates,
+    const LCDetectorParams& params,
+    const unsigned repetitions,
+    std::ostream& out);
+
+// Measures the throughput of query() as the number of reader threads grows.
+// The first half of the sequence is indexed, and the images of the second
+// half are used as queries, also while they are being indexed.
+void benchmarkQueries(const std::vector<std::vector<cv::KeyPoint> >& kps,
+                      const std::vector<cv::Mat>& descs,
+                      const LCDetectorParams& params,
+                      const unsigned max_readers,
+                      const unsigned nqueries,
+                      std::ostream& out);
+
+// Counts the heap allocations per image once the detector has processed the
+// first half of the sequence, giving the images either as keypoints and
+// descriptors or as FeatureFrames. Allocations are counted program-wide.
+void benchmarkAllocations(const std::vector<std::vector<cv::KeyPoint> >& kps,
+                          const std::vector<cv::Mat>& descs,
+                          const LCDetectorParams& params,
+                          std::ostream& out);
+
+}  // namespace ibow_lcd
+
+#endif  // EVALUATION_BENCHMARKS_H_
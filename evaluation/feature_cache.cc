@@ -0,0 +1,221 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "feature_cache.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+namespace ibow_lcd {
+
+namespace {
+
+const char kCacheMagic[8] = {'I', 'B', 'O', 'W', 'F', 'E', 'A', 'T'};
+const uint32_t kCacheVersion = 1;
+
+// Keypoint as stored in the cache
+struct CachedKeyPoint {
+  float x;
+  float y;
+  float size;
+  float angle;
+  float response;
+  int32_t octave;
+  int32_t class_id;
+};
+
+template <typename T>
+void writeValue(std::ofstream& out, const T& value) {
+  out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void writePadding(std::ofstream& out) {
+  static const char zeros[8] = {0};
+  std::streamoff pos = out.tellp();
+  if (pos % 8) {
+    out.write(zeros, 8 - pos % 8);
+  }
+}
+
+inline size_t align8(const size_t pos) {
+  return (pos + 7) & ~static_cast<size_t>(7);
+}
+
+}  // namespace
+
+FeatureCache::FeatureCache() {}
+
+bool FeatureCache::load(const std::string& filename,
+                        const std::string& key,
+                        std::vector<std::vector<cv::KeyPoint> >* kps,
+                        std::vector<cv::Mat>* descs) {
+  kps->clear();
+  descs->clear();
+  if (!file_.open(filename)) {
+    return false;
+  }
+
+  const char* data = file_.data();
+  size_t size = file_.size();
+
+  // Header
+  size_t pos = sizeof(kCacheMagic) + 2 * sizeof(uint32_t);
+  if (size < pos || memcmp(data, kCacheMagic, sizeof(kCacheMagic))) {
+    return false;
+  }
+  uint32_t version, key_len;
+  memcpy(&version, data + 8, sizeof(uint32_t));
+  memcpy(&key_len, data + 12, sizeof(uint32_t));
+  if (version != kCacheVersion || size < pos + key_len ||
+      key.compare(0, std::string::npos, data + pos, key_len) != 0) {
+    return false;
+  }
+  pos = align8(pos + key_len);
+
+  uint64_t nimages;
+  int32_t cols, type;
+  if (size < pos + sizeof(nimages) + 2 * sizeof(int32_t)) {
+    return false;
+  }
+  memcpy(&nimages, data + pos, sizeof(nimages));
+  memcpy(&cols, data + pos + 8, sizeof(int32_t));
+  memcpy(&type, data + pos + 12, sizeof(int32_t));
+  pos += 16;
+
+  // Number of keypoints of each image
+  if (size < pos + nimages * sizeof(uint32_t)) {
+    return false;
+  }
+  std::vector<uint32_t> nkps(nimages);
+  memcpy(nkps.data(), data + pos, nimages * sizeof(uint32_t));
+  pos = align8(pos + nimages * sizeof(uint32_t));
+
+  uint64_t total_kps = 0;
+  for (uint64_t i = 0; i < nimages; i++) {
+    total_kps += nkps[i];
+  }
+
+  // Keypoint table and descriptor blob
+  size_t row_bytes = static_cast<size_t>(cols) * CV_ELEM_SIZE(type);
+  size_t kps_pos = pos;
+  size_t descs_pos = align8(kps_pos + total_kps * sizeof(CachedKeyPoint));
+  if (size < descs_pos + total_kps * row_bytes) {
+    return false;
+  }
+
+  const CachedKeyPoint* ckps =
+                  reinterpret_cast<const CachedKeyPoint*>(data + kps_pos);
+  char* blob = const_cast<char*>(data + descs_pos);
+  kps->resize(nimages);
+  descs->resize(nimages);
+  for (uint64_t i = 0; i < nimages; i++) {
+    std::vector<cv::KeyPoint>& tkps = kps->at(i);
+    tkps.resize(nkps[i]);
+    for (uint32_t j = 0; j < nkps[i]; j++) {
+      const CachedKeyPoint& ckp = ckps[j];
+      tkps[j] = cv::KeyPoint(ckp.x, ckp.y, ckp.size, ckp.angle, ckp.response,
+                             ckp.octave, ckp.class_id);
+    }
+
+    if (nkps[i]) {
+      descs->at(i) = cv::Mat(nkps[i], cols, type, blob);
+    }
+    ckps += nkps[i];
+    blob += nkps[i] * row_bytes;
+  }
+
+  return true;
+}
+
+bool FeatureCache::save(const std::string& filename,
+                        const std::string& key,
+                        const std::vector<std::vector<cv::KeyPoint> >& kps,
+                        const std::vector<cv::Mat>& descs) {
+  // All the descriptors should have the same size and type
+  int32_t cols = 0, type = 0;
+  for (unsigned i = 0; i < descs.size(); i++) {
+    if (descs[i].rows != static_cast<int>(kps[i].size())) {
+      return false;
+    }
+    if (descs[i].empty()) {
+      continue;
+    }
+    if (cols == 0) {
+      cols = descs[i].cols;
+      type = descs[i].type();
+    } else if (descs[i].cols != cols || descs[i].type() != type) {
+      return false;
+    }
+  }
+
+  std::ofstream out(filename, std::ios::binary);
+  if (!out.is_open()) {
+    return false;
+  }
+
+  // Header
+  out.write(kCacheMagic, sizeof(kCacheMagic));
+  writeValue(out, kCacheVersion);
+  writeValue(out, static_cast<uint32_t>(key.size()));
+  out.write(key.data(), key.size());
+  writePadding(out);
+  writeValue(out, static_cast<uint64_t>(kps.size()));
+  writeValue(out, cols);
+  writeValue(out, type);
+
+  // Number of keypoints of each image
+  for (unsigned i = 0; i < kps.size(); i++) {
+    writeValue(out, static_cast<uint32_t>(kps[i].size()));
+  }
+  writePadding(out);
+
+  // Keypoint table
+  for (unsigned i = 0; i < kps.size(); i++) {
+    for (unsigned j = 0; j < kps[i].size(); j++) {
+      const cv::KeyPoint& kp = kps[i][j];
+      CachedKeyPoint ckp = {kp.pt.x, kp.pt.y, kp.size, kp.angle, kp.response,
+                            kp.octave, kp.class_id};
+      writeValue(out, ckp);
+    }
+  }
+  writePadding(out);
+
+  // Descriptor blob
+  for (unsigned i = 0; i < descs.size(); i++) {
+    size_t row_bytes = descs[i].cols * descs[i].elemSize();
+    for (int r = 0; r < descs[i].rows; r++) {
+      out.write(reinterpret_cast<const char*>(descs[i].ptr(r)), row_bytes);
+    }
+  }
+
+  return out.good();
+}
+
+std::string FeatureCache::filename(const std::string& cache_dir,
+                                   const std::string& key) {
+  std::stringstream ss;
+  ss << cache_dir << "/features_" << std::hex
+     << std::hash<std::string>()(key) << ".bin";
+  return ss.str();
+}
+
+}  // namespace ibow_lcd
@@ -0,0 +1,60 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EVALUATION_FEATURE_CACHE_H_
+#define EVALUATION_FEATURE_CACHE_H_
+
+#include <string>
+#include <vector>
+
+#include <opencv2/features2d.hpp>
+
+#include "ibow-lcd/mapped_file.h"
+
+namespace ibow_lcd {
+
+// FeatureCache: keypoints and descriptors of a whole sequence in a single
+// file. The descriptors of all the images are stored in one contiguous blob,
+// so the loaded matrices point to the mapped file instead of being copied.
+// The key identifies the images and the detector settings used.
+class FeatureCache {
+ public:
+  FeatureCache();
+
+  // The descriptors are valid while this object is alive
+  bool load(const std::string& filename,
+            const std::string& key,
+            std::vector<std::vector<cv::KeyPoint> >* kps,
+            std::vector<cv::Mat>* descs);
+  static bool save(const std::string& filename,
+                   const std::string& key,
+                   const std::vector<std::vector<cv::KeyPoint> >& kps,
+                   const std::vector<cv::Mat>& descs);
+
+  // Cache file inside cache_dir for the given key
+  static std::string filename(const std::string& cache_dir,
+                              const std::string& key);
+
+ private:
+  MappedFile file_;
+};
+
+}  // namespace ibow_lcd
+
+#endif  // EVALUATION_FEATURE_CACHE_H_
@@ -0,0 +1,283 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "groundtruth.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace ibow_lcd {
+
+namespace {
+
+// MAT file data types
+enum {
+  miINT8 = 1,
+  miUINT8 = 2,
+  miINT16 = 3,
+  miUINT16 = 4,
+  miINT32 = 5,
+  miUINT32 = 6,
+  miSINGLE = 7,
+  miDOUBLE = 9,
+  miINT64 = 12,
+  miUINT64 = 13,
+  miMATRIX = 14,
+  miCOMPRESSED = 15
+};
+
+// MAT file array classes
+const uint32_t mxSPARSE_CLASS = 5;
+
+// Data element: type, size and position of its data
+struct Element {
+  uint32_t type;
+  uint32_t nbytes;
+  const char* data;
+  size_t next;  // Offset of the next element
+};
+
+bool readElement(const char* data, const size_t size, const size_t pos,
+                 Element* elem) {
+  if (pos + 8 > size) {
+    return false;
+  }
+
+  uint32_t tag[2];
+  memcpy(tag, data + pos, sizeof(tag));
+  if (tag[0] >> 16) {
+    // Small data element, packed with its tag
+    elem->type = tag[0] & 0xffff;
+    elem->nbytes = tag[0] >> 16;
+    elem->data = data + pos + 4;
+    elem->next = pos + 8;
+    return elem->nbytes <= 4;
+  }
+
+  elem->type = tag[0];
+  elem->nbytes = tag[1];
+  elem->data = data + pos + 8;
+  elem->next = pos + 8 + elem->nbytes;
+  if (elem->type != miCOMPRESSED) {
+    elem->next = (elem->next + 7) & ~static_cast<size_t>(7);
+  }
+
+  return pos + 8 + elem->nbytes <= size;
+}
+
+template <typename T>
+double valueAt(const char* data, const size_t i) {
+  T value;
+  memcpy(&value, data + i * sizeof(T), sizeof(T));
+  return static_cast<double>(value);
+}
+
+// Value i of a numeric data element, as a double
+double numericValue(const Element& elem, const size_t i) {
+  switch (elem.type) {
+    case miINT8: return valueAt<int8_t>(elem.data, i);
+    case miUINT8: return valueAt<uint8_t>(elem.data, i);
+    case miINT16: return valueAt<int16_t>(elem.data, i);
+    case miUINT16: return valueAt<uint16_t>(elem.data, i);
+    case miINT32: return valueAt<int32_t>(elem.data, i);
+    case miUINT32: return valueAt<uint32_t>(elem.data, i);
+    case miSINGLE: return valueAt<float>(elem.data, i);
+    case miDOUBLE: return valueAt<double>(elem.data, i);
+    case miINT64: return valueAt<int64_t>(elem.data, i);
+    case miUINT64: return valueAt<uint64_t>(elem.data, i);
+    default: return 0.0;
+  }
+}
+
+size_t numericSize(const uint32_t type) {
+  switch (type) {
+    case miINT8: case miUINT8: return 1;
+    case miINT16: case miUINT16: return 2;
+    case miINT32: case miUINT32: case miSINGLE: return 4;
+    case miDOUBLE: case miINT64: case miUINT64: return 8;
+    default: return 0;
+  }
+}
+
+bool inflateElement(const char* data, const size_t size,
+                    std::vector<char>* out) {
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit(&strm) != Z_OK) {
+    return false;
+  }
+
+  strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  strm.avail_in = size;
+  out->resize(std::max<size_t>(size * 4, 1024));
+  int ret = Z_OK;
+  while (ret == Z_OK) {
+    if (strm.total_out == out->size()) {
+      out->resize(out->size() * 2);
+    }
+    strm.next_out = reinterpret_cast<Bytef*>(out->data() + strm.total_out);
+    strm.avail_out = out->size() - strm.total_out;
+    ret = inflate(&strm, Z_NO_FLUSH);
+  }
+  out->resize(strm.total_out);
+  inflateEnd(&strm);
+
+  return ret == Z_STREAM_END;
+}
+
+}  // namespace
+
+GroundTruth::GroundTruth() :
+    cols_(0) {}
+
+bool GroundTruth::load(const std::string& filename, const std::string& var) {
+  cols_ = 0;
+  loops_.clear();
+
+  std::ifstream in(filename, std::ios::binary);
+  if (!in.is_open()) {
+    return false;
+  }
+  std::vector<char> file((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+
+  // Header: text, subsystem offset, version and endianness. Only files
+  // written with the same endianness are supported.
+  if (file.size() < 128 || file[126] != 'I' || file[127] != 'M') {
+    return false;
+  }
+
+  bool found = false;
+  return parseElements(file.data() + 128, file.size() - 128, var, &found) &&
+         found;
+}
+
+bool GroundTruth::hasLoop(const unsigned row,
+                          const unsigned min_col,
+                          const unsigned max_col) const {
+  if (row >= loops_.size()) {
+    return false;
+  }
+
+  const std::vector<unsigned>& cols = loops_[row];
+  auto it = std::lower_bound(cols.begin(), cols.end(), min_col);
+  return it != cols.end() && *it <= max_col;
+}
+
+bool GroundTruth::parseElements(const char* data, const size_t size,
+                                const std::string& var, bool* found) {
+  size_t pos = 0;
+  while (pos < size && !*found) {
+    Element elem;
+    if (!readElement(data, size, pos, &elem)) {
+      return false;
+    }
+
+    if (elem.type == miCOMPRESSED) {
+      std::vector<char> inflated;
+      if (!inflateElement(elem.data, elem.nbytes, &inflated) ||
+          !parseElements(inflated.data(), inflated.size(), var, found)) {
+        return false;
+      }
+    } else if (elem.type == miMATRIX) {
+      if (!parseMatrix(elem.data, elem.nbytes, var, found)) {
+        return false;
+      }
+    }
+
+    pos = elem.next;
+  }
+
+  return true;
+}
+
+bool GroundTruth::parseMatrix(const char* data, const size_t size,
+                              const std::string& var, bool* found) {
+  // Array flags, dimensions and name
+  Element flags, dims, name;
+  if (!readElement(data, size, 0, &flags) || flags.nbytes < 8 ||
+      !readElement(data, size, flags.next, &dims) ||
+      !readElement(data, size, dims.next, &name)) {
+    return false;
+  }
+
+  std::string name_str(name.data, name.nbytes);
+  if (name_str != var || dims.nbytes != 2 * sizeof(int32_t)) {
+    // Another variable, or not a 2D matrix
+    return true;
+  }
+
+  uint32_t array_class = numericValue(flags, 0);
+  array_class &= 0xff;
+  unsigned nrows = numericValue(dims, 0);
+  unsigned ncols = numericValue(dims, 1);
+  cols_ = ncols;
+  loops_.assign(nrows, std::vector<unsigned>());
+
+  if (array_class == mxSPARSE_CLASS) {
+    // Compressed sparse columns: row indices, column starts and values
+    Element ir, jc, pr;
+    if (!readElement(data, size, name.next, &ir) ||
+        !readElement(data, size, ir.next, &jc) ||
+        !readElement(data, size, jc.next, &pr) ||
+        jc.nbytes < (ncols + 1) * sizeof(int32_t)) {
+      return false;
+    }
+
+    size_t nvalues = numericSize(pr.type) ? pr.nbytes / numericSize(pr.type)
+                                          : 0;
+    for (unsigned c = 0; c < ncols; c++) {
+      size_t start = numericValue(jc, c);
+      size_t end = numericValue(jc, c + 1);
+      for (size_t k = start; k < end; k++) {
+        unsigned r = numericValue(ir, k);
+        // Logical sparse matrices may omit the values
+        if (r < nrows && (k >= nvalues || numericValue(pr, k) != 0.0)) {
+          loops_[r].push_back(c);
+        }
+      }
+    }
+  } else {
+    // Dense matrix stored by columns
+    Element pr;
+    if (!readElement(data, size, name.next, &pr) ||
+        !numericSize(pr.type) ||
+        pr.nbytes < static_cast<size_t>(nrows) * ncols *
+                    numericSize(pr.type)) {
+      return false;
+    }
+
+    for (unsigned c = 0; c < ncols; c++) {
+      for (unsigned r = 0; r < nrows; r++) {
+        if (numericValue(pr, static_cast<size_t>(c) * nrows + r) != 0.0) {
+          loops_[r].push_back(c);
+        }
+      }
+    }
+  }
+
+  *found = true;
+  return true;
+}
+
+}  // namespace ibow_lcd
@@ -0,0 +1,63 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EVALUATION_GROUNDTRUTH_H_
+#define EVALUATION_GROUNDTRUTH_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ibow_lcd {
+
+// GroundTruth: loop closure ground truth matrix, where the row i indicates
+// the previous images closing a loop with image i. It is read from a MATLAB
+// MAT file (level 5, compressed or not, dense or sparse).
+class GroundTruth {
+ public:
+  GroundTruth();
+
+  bool load(const std::string& filename, const std::string& var = "truth");
+
+  inline unsigned rows() const { return loops_.size(); }
+  inline unsigned cols() const { return cols_; }
+
+  // Number of loops of the row
+  inline unsigned numLoops(const unsigned row) const {
+    return row < loops_.size() ? loops_[row].size() : 0;
+  }
+
+  // Is there any loop in the row between both columns, included?
+  bool hasLoop(const unsigned row,
+               const unsigned min_col,
+               const unsigned max_col) const;
+
+ private:
+  unsigned cols_;
+  std::vector<std::vector<unsigned> > loops_;  // Sorted columns of each row
+
+  bool parseElements(const char* data, const size_t size,
+                     const std::string& var, bool* found);
+  bool parseMatrix(const char* data, const size_t size,
+                   const std::string& var, bool* found);
+};
+
+}  // namespace ibow_lcd
+
+#endif  // EVALUATION_GROUNDTRUTH_H_
@@ -28,43 +28,73 @@ void LCEvaluator::detectLoops(
       const std::vector<std::vector<cv::KeyPoint> >& kps,
       const std::vector<cv::Mat>& descs,
       std::vector<LCDetectorResult>* results) {
-  results->clear();
+  // Creating the loop closure detector object
+  ibow_lcd::LCDetector lcdet(index_params_);
+
+  // Processing the sequence of images
+  lcdet.processBatch(image_ids, kps, descs, results);
+  stats_ = lcdet.stats();
+}
+
+void LCEvaluator::detectLoops(
+    const std::vector<unsigned>& image_ids,
+    const std::vector<std::vector<cv::KeyPoint> >& kps,
+    const std::vector<cv::Mat>& descs,
+    ResultSink* sink) {
   unsigned nimages = image_ids.size();
 
   // Creating the loop closure detector object
   ibow_lcd::LCDetector lcdet(index_params_);
+  lcdet.setSink(sink);
 
-  // Processing the sequence of images
+  // Processing the sequence of images one by one, as online
+  LCDetectorResult result;
   for (unsigned i = 0; i < nimages; i++) {
-    // Processing image i
-    // std::cout << "--- Processing image " << i;
-
-    ibow_lcd::LCDetectorResult result;
     lcdet.process(image_ids[i], kps[i], descs[i], &result);
+  }
+  sink->flush();
+  stats_ = lcdet.stats();
+}
+
+void LCEvaluator::searchImages(
+    const std::vector<unsigned>& image_ids,
+    const std::vector<std::vector<cv::KeyPoint> >& kps,
+    const std::vector<cv::Mat>& descs,
+    const double min_score,
+    std::vector<LCDetectorSearch>* searches) {
+  unsigned nimages = image_ids.size();
+  searches->clear();
+  searches->resize(nimages);
 
-    // if (result.status == LC_DETECTED) {
-    //   std::cout << " --- Loop detected!!!: " << result.train_id;
-    // }
+  // Creating the loop closure detector object
+  ibow_lcd::LCDetector lcdet(index_params_);
 
-    results->push_back(result);
-    // std::cout << std::endl;
+  // Searching the sequence of images, keeping only the useful candidates
+  for (unsigned i = 0; i < nimages; i++) {
+    lcdet.search(image_ids[i], kps[i], descs[i], &searches->at(i));
+    searches->at(i).trim(min_score);
   }
 }
 
-void LCEvaluator::detectLoops(
+void LCEvaluator::replayLoops(
     const std::vector<unsigned>& image_ids,
     const std::vector<std::vector<cv::KeyPoint> >& kps,
     const std::vector<cv::Mat>& descs,
-    std::ofstream& out_file) {
+    const std::vector<LCDetectorSearch>& searches,
+    std::vector<LCDetectorResult>* results) {
   unsigned nimages = image_ids.size();
+  results->clear();
+  results->resize(nimages);
 
   // Creating the loop closure detector object
   ibow_lcd::LCDetector lcdet(index_params_);
 
   // Processing the sequence of images
   for (unsigned i = 0; i < nimages; i++) {
-    lcdet.debug(image_ids[i], kps[i], descs[i], out_file);
+    lcdet.replay(image_ids[i], kps[i], descs[i], searches[i],
+                 &results->at(i));
   }
+  stats_ = lcdet.stats();
 }
 
 }  // namespace ibow_lcd
@@ -28,6 +28,7 @@
 #include <opencv2/features2d.hpp>
 
 #include "ibow-lcd/lcdetector.h"
+#include "ibow-lcd/result_sink.h"
 
 namespace ibow_lcd {
 
@@ -46,14 +47,34 @@ class LCEvaluator {
     const std::vector<unsigned>& image_ids,
     const std::vector<std::vector<cv::KeyPoint> >& kps,
     const std::vector<cv::Mat>& descs,
-    std::ofstream& out_file);
+    ResultSink* sink);
+
+  // Searches of the index alone, and detection replaying them
+  void searchImages(
+    const std::vector<unsigned>& image_ids,
+    const std::vector<std::vector<cv::KeyPoint> >& kps,
+    const std::vector<cv::Mat>& descs,
+    const double min_score,
+    std::vector<LCDetectorSearch>* searches);
+  void replayLoops(
+    const std::vector<unsigned>& image_ids,
+    const std::vector<std::vector<cv::KeyPoint> >& kps,
+    const std::vector<cv::Mat>& descs,
+    const std::vector<LCDetectorSearch>& searches,
+    std::vector<LCDetectorResult>* results);
 
   inline void setIndexParams(const LCDetectorParams& params) {
     index_params_ = params;
   }
 
+  // Stats of the last detection, if the params ask for them
+  inline const std::vector<LCDetectorStats>& stats() const {
+    return stats_;
+  }
+
  private:
   LCDetectorParams index_params_;
+  std::vector<LCDetectorStats> stats_;
 };
 
 }  // namespace ibow_lcd
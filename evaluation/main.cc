@@ -17,13 +17,28 @@
 * along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <omp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
 
 #include <boost/filesystem.hpp>
 #include <opencv2/features2d.hpp>
 
+#include "ibow-lcd/feature_pipeline.h"
+#include "benchmarks.h"
+#include "feature_cache.h"
+#include "groundtruth.h"
 #include "lcevaluator.h"
+#include "precision_recall.h"
 #include "json.hpp"
 
 using json = nlohmann::json;
@@ -50,6 +65,162 @@ void getFilenames(const std::string& directory,
     }
 }
 
+// Reads a parameter from the JSON object, if present
+template <typename T>
+void readParam(const json& js, const std::string& key, T* value) {
+  if (js.find(key) != js.end()) {
+    *value = js[key].get<T>();
+  }
+}
+
+// The loop closure params are required. The rest keep their default values
+// unless given.
+void parseParams(const json& js, ibow_lcd::LCDetectorParams* params) {
+  params->purge_descriptors = js.at("purge_descriptors");
+  params->min_feat_apps = js.at("min_feat_apps");
+  params->nndr = js.at("nndr");
+  params->nndr_bf = js.at("nndr_bf");
+  params->ep_dist = js.at("ep_dist");
+  params->conf_prob = js.at("conf_prob");
+  params->p = js.at("p");
+  params->min_score = js.at("min_score");
+  params->island_size = js.at("island_size");
+  params->min_inliers = js.at("min_inliers");
+  params->nframes_after_lc = js.at("nframes_after_lc");
+  params->min_consecutive_loops = js.at("min_consecutive_loops");
+  readParam(js, "reuse_query_search", &params->reuse_query_search);
+  readParam(js, "async_insertion", &params->async_insertion);
+  readParam(js, "batch_size", &params->batch_size);
+  readParam(js, "max_verified_islands", &params->max_verified_islands);
+  readParam(js, "guided_matching", &params->guided_matching);
+  readParam(js, "guided_radius", &params->guided_radius);
+  if (js.find("bf_matcher") != js.end()) {
+    std::string matcher = js["bf_matcher"];
+    if (matcher == "scalar") {
+      params->bf_matcher = ibow_lcd::BF_MATCHER_SCALAR;
+    } else if (matcher == "simd") {
+      params->bf_matcher = ibow_lcd::BF_MATCHER_SIMD;
+    } else {
+      params->bf_matcher = ibow_lcd::BF_MATCHER_OPENCV;
+    }
+  }
+  if (js.find("verifier") != js.end()) {
+    std::string verifier = js["verifier"];
+    if (verifier == "preemptive") {
+      params->verifier = ibow_lcd::VERIFIER_FUNDAMENTAL_PREEMPTIVE;
+    } else if (verifier == "homography") {
+      params->verifier = ibow_lcd::VERIFIER_HOMOGRAPHY_PROSAC;
+    } else if (verifier == "essential") {
+      params->verifier = ibow_lcd::VERIFIER_ESSENTIAL;
+    } else {
+      params->verifier = ibow_lcd::VERIFIER_FUNDAMENTAL;
+    }
+  }
+  readParam(js, "focal_length", &params->focal_length);
+  readParam(js, "pp_x", &params->pp_x);
+  readParam(js, "pp_y", &params->pp_y);
+  readParam(js, "early_exit_verification", &params->early_exit_verification);
+  readParam(js, "kf_budget", &params->kf_budget);
+  readParam(js, "kf_spill_dir", &params->kf_spill_dir);
+  readParam(js, "collect_stats", &params->collect_stats);
+  if (js.find("forget_policy") != js.end()) {
+    std::string policy = js["forget_policy"];
+    if (policy == "oldest") {
+      params->forget_policy = ibow_lcd::FORGET_OLDEST;
+    } else if (policy == "decimate") {
+      params->forget_policy = ibow_lcd::FORGET_DECIMATE;
+    } else {
+      params->forget_policy = ibow_lcd::FORGET_NONE;
+    }
+  }
+  readParam(js, "max_indexed_images", &params->max_indexed_images);
+  readParam(js, "forget_step", &params->forget_step);
+  readParam(js, "redundancy_ratio", &params->redundancy_ratio);
+  readParam(js, "snapshots", &params->snapshots);
+}
+
+// Distribution of a measure over the images of the sequence
+json summarizeValues(std::vector<double> values) {
+  json js;
+  if (values.empty()) {
+    return js;
+  }
+
+  // Nearest-rank percentiles
+  std::sort(values.begin(), values.end());
+  auto percentile = [&values](const double pct) {
+    unsigned rank = static_cast<unsigned>(std::ceil(pct * values.size()));
+    return values[rank > 0 ? rank - 1 : 0];
+  };
+
+  double sum = 0.0;
+  for (unsigned i = 0; i < values.size(); i++) {
+    sum += values[i];
+  }
+
+  js["p50"] = percentile(0.50);
+  js["p95"] = percentile(0.95);
+  js["p99"] = percentile(0.99);
+  js["mean"] = sum / values.size();
+  js["max"] = values.back();
+  return js;
+}
+
+// Writes the times (ms) and counters of each stage of the detector
+void writeStats(const std::vector<ibow_lcd::LCDetectorStats>& stats,
+                const std::string& filename) {
+  json stats_json;
+  stats_json["images"] = stats.size();
+
+  for (unsigned s = 0; s < ibow_lcd::NUM_STAGES; s++) {
+    ibow_lcd::LCDetectorStage stage = static_cast<ibow_lcd::LCDetectorStage>(s);
+    std::vector<double> values(stats.size());
+    for (unsigned i = 0; i < stats.size(); i++) {
+      values[i] = stats[i].time[stage];
+    }
+    stats_json["time"][ibow_lcd::stageName(stage)] = summarizeValues(values);
+  }
+
+  std::vector<double> candidates(stats.size());
+  std::vector<double> islands(stats.size());
+  std::vector<double> putative_matches(stats.size());
+  std::vector<double> inliers(stats.size());
+  std::vector<double> vocabulary_size(stats.size());
+  for (unsigned i = 0; i < stats.size(); i++) {
+    candidates[i] = stats[i].candidates;
+    islands[i] = stats[i].islands;
+    putative_matches[i] = stats[i].putative_matches;
+    inliers[i] = stats[i].inliers;
+    vocabulary_size[i] = stats[i].vocabulary_size;
+  }
+  stats_json["candidates"] = summarizeValues(candidates);
+  stats_json["islands"] = summarizeValues(islands);
+  stats_json["putative_matches"] = summarizeValues(putative_matches);
+  stats_json["inliers"] = summarizeValues(inliers);
+  stats_json["vocabulary_size"] = summarizeValues(vocabulary_size);
+
+  std::ofstream stats_file(filename);
+  stats_file << std::setw(4) << stats_json << std::endl;
+}
+
+// Params that determine the searches of the index. Executions that only
+// differ in the remaining ones can share them.
+std::string indexStageKey(const ibow_lcd::LCDetectorParams& params) {
+  std::stringstream ss;
+  ss << params.k << " " << params.s << " " << params.t << " "
+     << params.merge_policy << " " << params.purge_descriptors << " "
+     << params.min_feat_apps << " " << params.p << " " << params.nndr << " "
+     << params.reuse_query_search << " " << params.async_insertion << " "
+     << params.guided_matching << " " << params.forget_policy << " "
+     << params.redundancy_ratio;
+  // Forgetting modifies the index, and decimation depends on the islands
+  if (params.forget_policy != ibow_lcd::FORGET_NONE) {
+    ss << " " << params.max_indexed_images << " " << params.forget_step << " "
+       << params.island_size;
+  }
+  return ss.str();
+}
+
 int main(int argc, char** argv) {
   if (argc != 2) {
     std::cout << "Incorrect usage. Please, call the program indicating only a ";
@@ -100,6 +271,18 @@ int main(int argc, char** argv) {
 
   // Writing information to the info file
   info_file << std::setw(4) << info_json << std::endl;
+
+  // Loading the ground truth to compute precision / recall, if available
+  ibow_lcd::GroundTruth gt;
+  bool has_gt = gt.load(base_dir + "groundtruth.mat");
+  unsigned gt_neigh = 20;
+  bool compensate = false;
+  readParam(js, "gt_neigh", &gt_neigh);
+  readParam(js, "compensate", &compensate);
+  if (!has_gt) {
+    std::cout << "Ground truth not available, P/R will not be computed"
+              << std::endl;
+  }
   info_file.close();
 
   // Loading image filenames
@@ -113,27 +296,95 @@ int main(int argc, char** argv) {
   std::vector<std::vector<cv::KeyPoint> > kps;
   std::vector<cv::Mat> descs;
 
-  std::cout << "Describing images ..." << std::endl;
-  cv::Ptr<cv::Feature2D> detector = cv::ORB::create(1500);  // Default params
-
-  // Processing the sequence of images
-  for (unsigned i = 0; i < nimages; i++) {
-    // Processing image i
+  // Features are loaded from the cache, if any, keyed by the images and the
+  // detector settings
+  const int nfeatures = 1500;
+  ibow_lcd::FeatureCache feature_cache;
+  std::string cache_key;
+  std::string cache_filename;
+  bool cached = false;
+  if (js.find("feature_cache_dir") != js.end()) {
+    std::string cache_dir = js["feature_cache_dir"];
+    boost::filesystem::create_directories(cache_dir);
+
+    std::stringstream key;
+    key << base_dir << "images/" << "|ORB nfeatures=" << nfeatures << "|";
+    for (unsigned i = 0; i < nimages; i++) {
+      key << filenames[i] << "|";
+    }
+    cache_key = key.str();
+    cache_filename = ibow_lcd::FeatureCache::filename(cache_dir, cache_key);
+    cached = feature_cache.load(cache_filename, cache_key, &kps, &descs);
+  }
 
-    // Loading and describing the image
-    cv::Mat img = cv::imread(filenames[i]);
-    std::vector<cv::KeyPoint> tkps;
-    detector->detect(img, tkps);
-    cv::Mat tdescs;
-    detector->compute(img, tkps, tdescs);
+  if (cached) {
+    std::cout << "Features loaded from " << cache_filename << std::endl;
+    for (unsigned i = 0; i < nimages; i++) {
+      image_ids.push_back(i);
+    }
+  } else {
+    std::cout << "Describing images ..." << std::endl;
+    unsigned nthreads = 0;
+    readParam(js, "extraction_threads", &nthreads);
+    ibow_lcd::FeaturePipeline pipeline(filenames, [nfeatures]() {
+      return cv::ORB::create(nfeatures);
+    }, nthreads);
+
+    // Processing the sequence of images
+    ibow_lcd::FeatureFrame frame;
+    while (pipeline.next(&frame)) {
+      image_ids.push_back(frame.image_id);
+      kps.push_back(frame.kps);
+      descs.push_back(frame.descs);
+    }
 
-    image_ids.push_back(i);
-    kps.push_back(tkps);
-    descs.push_back(tdescs);
+    if (!cache_filename.empty() &&
+        !ibow_lcd::FeatureCache::save(cache_filename, cache_key, kps, descs)) {
+      std::cout << "Unable to write " << cache_filename << std::endl;
+    }
   }
 
   std::cout << "Images described" << std::endl;
 
+  // Optional micro-benchmarks
+  if (js.find("benchmark_matchers") != js.end() && js["benchmark_matchers"]) {
+    ibow_lcd::benchmarkMatchers(descs, 0.8f, 500, std::cout);
+  }
+  if (js.find("benchmark_verifiers") != js.end() && js["benchmark_verifiers"]) {
+    ibow_lcd::LCDetectorParams params;
+    parseParams(js, &params);
+    ibow_lcd::benchmarkVerifiers(kps, descs, params, 500, std::cout);
+  }
+  if (js.find("benchmark_islands") != js.end() && js["benchmark_islands"]) {
+    // Recording the candidates returned by the index for each image
+    ibow_lcd::LCDetectorParams params;
+    parseParams(js, &params);
+    ibow_lcd::LCEvaluator search_eval;
+    search_eval.setIndexParams(params);
+    std::vector<ibow_lcd::LCDetectorSearch> searches;
+    search_eval.searchImages(image_ids, kps, descs, 0.0, &searches);
+
+    std::vector<std::vector<obindex2::ImageMatch> > candidates;
+    for (unsigned i = 0; i < searches.size(); i++) {
+      candidates.push_back(searches[i].image_matches);
+    }
+    ibow_lcd::benchmarkIslands(candidates, params, 20, std::cout);
+  }
+  if (js.find("benchmark_queries") != js.end() && js["benchmark_queries"]) {
+    ibow_lcd::LCDetectorParams params;
+    parseParams(js, &params);
+    unsigned max_readers = std::thread::hardware_concurrency();
+    readParam(js, "query_readers", &max_readers);
+    ibow_lcd::benchmarkQueries(kps, descs, params, std::max(max_readers, 1u),
+                               200, std::cout);
+  }
+  if (js.find("benchmark_allocations") != js.end() &&
+      js["benchmark_allocations"]) {
+    ibow_lcd::LCDetectorParams params;
+    parseParams(js, &params);
+    ibow_lcd::benchmarkAllocations(kps, descs, params, std::cout);
+  }
+
   // Executing the corresponding steps
   ibow_lcd::LCEvaluator eval;
 
@@ -142,54 +393,160 @@ int main(int argc, char** argv) {
 
     // Obtaining parameters
     ibow_lcd::LCDetectorParams params;
-    params.purge_descriptors = js["purge_descriptors"];
-    params.min_feat_apps = js["min_feat_apps"];
-    params.nndr = js["nndr"];
-    params.nndr_bf = js["nndr_bf"];
-    params.ep_dist = js["ep_dist"];
-    params.conf_prob = js["conf_prob"];
-    params.p = js["p"];
-    params.min_score = js["min_score"];
-    params.island_size = js["island_size"];
-    params.min_inliers = js["min_inliers"];
-    params.nframes_after_lc = js["nframes_after_lc"];
-    params.min_consecutive_loops = js["min_consecutive_loops"];
+    parseParams(js, &params);
 
     eval.setIndexParams(params);
 
-    // Writing the results to a file
-    char output_filename[500];
-    sprintf(output_filename, "%s%s/loops.txt", results_dir.c_str(),
-                                               config_name.c_str());
-    std::ofstream output_file(output_filename);
-    eval.detectLoops(image_ids, kps, descs, output_file);
-    output_file.close();
+    // Writing the trace of each image to a file, as text or binary records
+    std::string trace_format = "tsv";
+    readParam(js, "trace_format", &trace_format);
+    bool binary = trace_format == "binary";
+    std::string output_filename = results_dir + config_name +
+                                  (binary ? "/loops.bin" : "/loops.txt");
+    std::unique_ptr<ibow_lcd::ResultSink> sink;
+    if (binary) {
+      sink.reset(new ibow_lcd::BinarySink(output_filename));
+    } else {
+      sink.reset(new ibow_lcd::TsvSink(output_filename));
+    }
+    eval.detectLoops(image_ids, kps, descs, sink.get());
+    sink.reset();
+
+    if (params.collect_stats) {
+      writeStats(eval.stats(), results_dir + config_name + "/stats.json");
+    }
+
+    // Computing the P/R curve varying the minimum number of inliers
+    std::vector<ibow_lcd::DebugEntry> entries;
+    bool has_entries = false;
+    if (binary) {
+      std::vector<ibow_lcd::LCDetectorResult> results;
+      std::vector<ibow_lcd::LCDetectorTrace> traces;
+      has_entries = ibow_lcd::BinarySink::read(output_filename, &results,
+                                               &traces);
+      for (unsigned i = 0; i < traces.size(); i++) {
+        ibow_lcd::DebugEntry entry;
+        entry.min_id = traces[i].min_id;
+        entry.max_id = traces[i].max_id;
+        entry.img_id = traces[i].img_id;
+        entry.overlap = traces[i].overlap;
+        entry.inliers = traces[i].inliers;
+        entries.push_back(entry);
+      }
+    } else {
+      has_entries = ibow_lcd::readDebugFile(output_filename, &entries);
+    }
+
+    if (has_gt && has_entries) {
+      ibow_lcd::PRCurve curve;
+      ibow_lcd::computePRCurve(entries, gt, params.p,
+                               params.min_consecutive_loops, 500,
+                               gt_neigh, compensate, &curve);
+
+      json pr_json;
+      pr_json["P"] = curve.P;
+      pr_json["R"] = curve.R;
+      pr_json["P_max"] = curve.p_max;
+      pr_json["R_max"] = curve.r_max;
+      pr_json["I_max"] = curve.i_max;
+      pr_json["R_at_100P"] = curve.r_at_full_p;
+      pr_json["I_at_100P"] = curve.i_at_full_p;
+      std::ofstream pr_file(results_dir + config_name + "/pr.json");
+      pr_file << std::setw(4) << pr_json << std::endl;
+
+      std::cout << "Max recall at 100% precision: " << curve.r_at_full_p
+                << " (" << curve.i_at_full_p << " inliers)" << std::endl;
+    }
   } else {
+    // Reading all the configurations before running them
     unsigned nsteps = js["executions"].size();
+    // The JSON is not accessed from the execution threads
+    std::vector<ibow_lcd::LCDetectorParams> steps_params(nsteps);
+    std::vector<json> steps_json(nsteps);
     for (unsigned i = 0; i < nsteps; i++) {
-      std::cout << "Execution " << i << std::endl;
-
-      // Reading the current configuration
-      ibow_lcd::LCDetectorParams params;
-      params.purge_descriptors = js["executions"][i]["purge_descriptors"];
-      params.min_feat_apps = js["executions"][i]["min_feat_apps"];
-      params.nndr = js["executions"][i]["nndr"];
-      params.nndr_bf = js["executions"][i]["nndr_bf"];
-      params.ep_dist = js["executions"][i]["ep_dist"];
-      params.conf_prob = js["executions"][i]["conf_prob"];
-      params.p = js["executions"][i]["p"];
-      params.min_score = js["executions"][i]["min_score"];
-      params.island_size = js["executions"][i]["island_size"];
-      params.min_inliers = js["executions"][i]["min_inliers"];
-      params.nframes_after_lc = js["executions"][i]["nframes_after_lc"];
-      params.min_consecutive_loops = js["executions"][i]["min_consecutive_loops"];
+      steps_json[i] = js["executions"][i];
+      parseParams(steps_json[i], &steps_params[i]);
+    }
+
+    // Executions are independent, so they are run in parallel sharing the
+    // descriptors. The detectors run their own loops sequentially then.
+    int nthreads = 0;
+    readParam(js, "execution_threads", &nthreads);
+    if (nthreads <= 0) {
+      nthreads = omp_get_max_threads();
+    }
+    std::cout << "Running " << nsteps << " executions with " << nthreads
+              << " threads" << std::endl;
+
+    // Grouping the executions which share the index stage
+    bool share_index_stage = true;
+    readParam(js, "share_index_stage", &share_index_stage);
+    std::map<std::string, std::vector<unsigned> > groups;
+    for (unsigned i = 0; i < nsteps; i++) {
+      groups[indexStageKey(steps_params[i])].push_back(i);
+    }
+
+    std::vector<std::vector<unsigned> > shared_groups;
+    std::vector<int> step_group(nsteps, -1);
+    for (auto it = groups.begin(); it != groups.end(); it++) {
+      if (share_index_stage && it->second.size() > 1) {
+        for (unsigned j = 0; j < it->second.size(); j++) {
+          step_group[it->second[j]] = shared_groups.size();
+        }
+        shared_groups.push_back(it->second);
+      }
+    }
+
+    // Searching the index once per group
+    std::vector<std::vector<ibow_lcd::LCDetectorSearch> > searches(
+                                                      shared_groups.size());
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads)
+    for (int g = 0; g < static_cast<int>(shared_groups.size()); g++) {
+      auto start = std::chrono::steady_clock::now();
+
+      // Candidates below every min_score of the group can be dropped, and
+      // the search stages are timed if any execution collects stats
+      const std::vector<unsigned>& group = shared_groups[g];
+      ibow_lcd::LCDetectorParams group_params = steps_params[group[0]];
+      for (unsigned j = 1; j < group.size(); j++) {
+        group_params.min_score = std::min(group_params.min_score,
+                                          steps_params[group[j]].min_score);
+        group_params.collect_stats = group_params.collect_stats ||
+                                     steps_params[group[j]].collect_stats;
+      }
+      double min_score = group_params.min_score;
+
+      ibow_lcd::LCEvaluator group_eval;
+      group_eval.setIndexParams(group_params);
+      group_eval.searchImages(image_ids, kps, descs, min_score, &searches[g]);
+
+      auto end = std::chrono::steady_clock::now();
+      #pragma omp critical
+      std::cout << "Index stage shared by " << group.size()
+                << " executions finished in "
+                << std::chrono::duration<double>(end - start).count()
+                << " s" << std::endl;
+    }
+
+    std::vector<double> times(nsteps, 0.0);
+    std::vector<json> summaries(nsteps);
+    std::vector<ibow_lcd::PRResult> prs(nsteps);
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads)
+    for (int i = 0; i < static_cast<int>(nsteps); i++) {
+      auto start = std::chrono::steady_clock::now();
 
       // Configuring the evaluator
-      eval.setIndexParams(params);
+      ibow_lcd::LCEvaluator step_eval;
+      step_eval.setIndexParams(steps_params[i]);
 
-        // Executing the process
+      // Executing the process, replaying the searches if possible
       std::vector<ibow_lcd::LCDetectorResult> results;
-      eval.detectLoops(image_ids, kps, descs, &results);
+      if (step_group[i] >= 0) {
+        step_eval.replayLoops(image_ids, kps, descs,
+                              searches[step_group[i]], &results);
+      } else {
+        step_eval.detectLoops(image_ids, kps, descs, &results);
+      }
 
       // Writing the results to a file
       char output_filename[500];
@@ -199,6 +556,7 @@ int main(int argc, char** argv) {
                                               i);
 
       std::ofstream output_file(output_filename);
+      ibow_lcd::PRCounter counter(gt, gt_neigh, compensate);
       for (unsigned j = 0; j < results.size(); j++) {
         ibow_lcd::LCDetectorResult result = results[j];
         output_file << result.query_id << "\t";
@@ -206,8 +564,82 @@ int main(int argc, char** argv) {
         output_file << result.train_id << "\t";
         output_file << result.inliers;
         output_file << std::endl;
+        counter.add(result.status, result.train_id);
       }
       output_file.close();
+
+      // Times and counters of each stage. Executions running at the same
+      // time compete for the CPU, so use execution_threads = 1 to profile.
+      if (steps_params[i].collect_stats) {
+        sprintf(output_filename, "%s%s/stats_%03d.json",
+                                              results_dir.c_str(),
+                                              config_name.c_str(),
+                                              i);
+        writeStats(step_eval.stats(), output_filename);
+      }
+
+      // Summarizing the execution
+      if (has_gt) {
+        const ibow_lcd::PRResult& pr = counter.result();
+        prs[i] = pr;
+        json& summary = summaries[i];
+        summary["execution"] = i;
+        summary["params"] = steps_json[i];
+        summary["TP"] = pr.tp;
+        summary["FP"] = pr.fp;
+        summary["TN"] = pr.tn;
+        summary["FN"] = pr.fn;
+        summary["P"] = pr.precision();
+        summary["R"] = pr.recall();
+        summary["R_at_100P"] = pr.precision() == 1.0 ? pr.recall() : 0.0;
+
+        sprintf(output_filename, "%s%s/pr_%03d.json",
+                                              results_dir.c_str(),
+                                              config_name.c_str(),
+                                              i);
+        std::ofstream pr_file(output_filename);
+        pr_file << std::setw(4) << summary << std::endl;
+      }
+
+      auto end = std::chrono::steady_clock::now();
+      times[i] = std::chrono::duration<double>(end - start).count();
+
+      #pragma omp critical
+      std::cout << "Execution " << i << " finished in " << times[i]
+                << " s" << std::endl;
+    }
+
+    // Writing the wall time of each execution
+    std::ofstream times_file(results_dir + config_name + "/times.txt");
+    for (unsigned i = 0; i < nsteps; i++) {
+      times_file << i << "\t" << times[i] << std::endl;
+    }
+
+    // Ranking the executions by recall at 100% precision, then by precision
+    if (has_gt) {
+      std::vector<unsigned> ranking(nsteps);
+      for (unsigned i = 0; i < nsteps; i++) {
+        ranking[i] = i;
+        summaries[i]["time"] = times[i];
+      }
+      std::stable_sort(ranking.begin(), ranking.end(),
+                       [&prs](unsigned a, unsigned b) {
+        double ra = prs[a].precision() == 1.0 ? prs[a].recall() : 0.0;
+        double rb = prs[b].precision() == 1.0 ? prs[b].recall() : 0.0;
+        if (ra != rb) {
+          return ra > rb;
+        }
+        double pa = prs[a].tp + prs[a].fp ? prs[a].precision() : 0.0;
+        double pb = prs[b].tp + prs[b].fp ? prs[b].precision() : 0.0;
+        return pa > pb;
+      });
+
+      json summary_json = json::array();
+      for (unsigned i = 0; i < nsteps; i++) {
+        summary_json.push_back(summaries[ranking[i]]);
+      }
+      std::ofstream summary_file(results_dir + config_name + "/summary.json");
+      summary_file << std::setw(4) << summary_json << std::endl;
     }
   }
 
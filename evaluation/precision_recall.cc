@@ -0,0 +1,205 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "precision_recall.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#include "ibow-lcd/lcdetector.h"
+
+namespace ibow_lcd {
+
+namespace {
+
+// Classification of each image
+enum {
+  CLASS_TP,
+  CLASS_FP,
+  CLASS_TN,
+  CLASS_FN
+};
+
+}  // namespace
+
+double PRResult::precision() const {
+  if (tp + fp == 0) {
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  return static_cast<double>(tp) / (tp + fp);
+}
+
+double PRResult::recall() const {
+  if (tp + fn == 0) {
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  return static_cast<double>(tp) / (tp + fn);
+}
+
+PRCounter::PRCounter(const GroundTruth& gt,
+                     const unsigned gt_neigh,
+                     const bool compensate) :
+    gt_(gt),
+    gt_neigh_(gt_neigh),
+    compensate_(compensate) {}
+
+void PRCounter::add(const int status, const unsigned train_id) {
+  unsigned i = statuses_.size();
+  bool is_loop = status == LC_DETECTED;
+  unsigned gt_nloops = gt_.numLoops(i);
+
+  // Is there any loop around the candidate according to the ground truth?
+  bool gt_loop_closed = false;
+  if (is_loop) {
+    unsigned min_col = train_id > gt_neigh_ ? train_id - gt_neigh_ : 0;
+    unsigned max_col = train_id + gt_neigh_ + 1;
+    gt_loop_closed = gt_.hasLoop(i, min_col, max_col);
+  }
+
+  // Taking a decision about this image
+  int classified;
+  if (is_loop && gt_loop_closed) {
+    result_.tp++;
+    classified = CLASS_TP;
+
+    // We compensate the fact that the GT has been manually labelled
+    const unsigned nprevimgs = 3;
+    if (compensate_ && i >= nprevimgs) {
+      for (unsigned j = 1; j <= nprevimgs; j++) {
+        int prev_train = train_ids_[i - j];
+        int curr_train = train_id + 1;
+        if (statuses_[i - j] == LC_NOT_ENOUGH_INLIERS &&
+            prev_train > curr_train - 2 && prev_train < curr_train + 2) {
+          if (classified_[i - j] == CLASS_TN) {
+            result_.tn--;
+          } else if (classified_[i - j] == CLASS_FN) {
+            result_.fn--;
+          }
+        }
+      }
+    }
+  } else if (is_loop) {
+    result_.fp++;
+    classified = CLASS_FP;
+  } else if (gt_nloops == 0) {
+    result_.tn++;
+    classified = CLASS_TN;
+  } else {
+    result_.fn++;
+    classified = CLASS_FN;
+  }
+
+  statuses_.push_back(status);
+  train_ids_.push_back(train_id);
+  classified_.push_back(classified);
+}
+
+bool readDebugFile(const std::string& filename,
+                   std::vector<DebugEntry>* entries) {
+  entries->clear();
+  std::ifstream in(filename);
+  if (!in.is_open()) {
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(in, line)) {
+    std::stringstream ss(line);
+    DebugEntry entry;
+    if (ss >> entry.min_id >> entry.max_id >> entry.img_id >>
+              entry.overlap >> entry.inliers) {
+      entries->push_back(entry);
+    }
+  }
+
+  return true;
+}
+
+void computePRCurve(const std::vector<DebugEntry>& entries,
+                    const GroundTruth& gt,
+                    const unsigned p,
+                    const int min_consecutive_loops,
+                    const unsigned max_inliers,
+                    const unsigned gt_neigh,
+                    const bool compensate,
+                    PRCurve* curve) {
+  *curve = PRCurve();
+  std::vector<double> P(1, 1.0);
+  std::vector<double> R(1, 0.0);
+
+  for (unsigned min_inliers = 1; min_inliers <= max_inliers; min_inliers++) {
+    // Replaying the decisions for this threshold, as detect_loops.m does
+    PRCounter counter(gt, gt_neigh, compensate);
+    int consecutive_loops = 0;
+    for (unsigned i = 0; i < entries.size(); i++) {
+      const DebugEntry& entry = entries[i];
+      if (i + 1 < p) {
+        counter.add(LC_NOT_ENOUGH_IMAGES, 0);
+      } else if (entry.min_id == 0 && entry.max_id == 0) {
+        counter.add(LC_NOT_ENOUGH_ISLANDS, 0);
+      } else if ((consecutive_loops > min_consecutive_loops &&
+                  entry.overlap) || entry.inliers > min_inliers) {
+        counter.add(LC_DETECTED, entry.img_id);
+        consecutive_loops++;
+      } else {
+        counter.add(LC_NOT_ENOUGH_INLIERS, entry.img_id);
+        consecutive_loops = 0;
+      }
+    }
+
+    double pr = counter.result().precision();
+    double re = counter.result().recall();
+    P.push_back(pr);
+    R.push_back(re);
+
+    if (pr > curve->p_max || (pr == curve->p_max && re > curve->r_max)) {
+      curve->p_max = pr;
+      curve->r_max = re;
+      curve->i_max = min_inliers;
+    }
+    if (pr == 1.0 && re > curve->r_at_full_p) {
+      curve->r_at_full_p = re;
+      curve->i_at_full_p = min_inliers;
+    }
+  }
+
+  // Ordering the obtained results by recall
+  std::vector<unsigned> order(R.size());
+  for (unsigned i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&R](unsigned a, unsigned b) {
+    // Undefined values at the end, as MATLAB sorts them
+    return R[a] < R[b] || (!std::isnan(R[a]) && std::isnan(R[b]));
+  });
+
+  // Keeping the points where the precision does not increase
+  for (unsigned i = 0; i < order.size(); i++) {
+    double pr = P[order[i]];
+    if (curve->P.empty() || pr <= curve->P.back()) {
+      curve->P.push_back(pr);
+      curve->R.push_back(R[order[i]]);
+    }
+  }
+}
+
+}  // namespace ibow_lcd
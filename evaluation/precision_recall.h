@@ -0,0 +1,115 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EVALUATION_PRECISION_RECALL_H_
+#define EVALUATION_PRECISION_RECALL_H_
+
+#include <string>
+#include <vector>
+
+#include "groundtruth.h"
+
+namespace ibow_lcd {
+
+// PRResult: classification counters of a sequence
+struct PRResult {
+  PRResult() :
+    tp(0),
+    fp(0),
+    tn(0),
+    fn(0) {}
+
+  // NaN if undefined, as in MATLAB
+  double precision() const;
+  double recall() const;
+
+  int tp;  // True Positives
+  int fp;  // False Positives
+  int tn;  // True Negatives
+  int fn;  // False Negatives
+};
+
+// PRCounter: classifies the results of a sequence against the ground truth
+// as compute_PR.m does. The results are added in order, one per image.
+class PRCounter {
+ public:
+  explicit PRCounter(const GroundTruth& gt,
+                     const unsigned gt_neigh = 20,
+                     const bool compensate = false);
+
+  void add(const int status, const unsigned train_id);
+
+  inline const PRResult& result() const { return result_; }
+
+ private:
+  const GroundTruth& gt_;
+  unsigned gt_neigh_;
+  bool compensate_;
+  PRResult result_;
+
+  // Previous results, needed to compensate the manual labelling
+  std::vector<int> statuses_;
+  std::vector<unsigned> train_ids_;
+  std::vector<int> classified_;
+};
+
+// DebugEntry: a line of the trace written by a TsvSink
+struct DebugEntry {
+  unsigned min_id;
+  unsigned max_id;
+  unsigned img_id;
+  bool overlap;
+  unsigned inliers;
+};
+
+bool readDebugFile(const std::string& filename,
+                   std::vector<DebugEntry>* entries);
+
+// PRCurve: precision / recall varying the minimum number of inliers
+struct PRCurve {
+  PRCurve() :
+    p_max(0.0),
+    r_max(0.0),
+    i_max(0),
+    r_at_full_p(0.0),
+    i_at_full_p(0) {}
+
+  std::vector<double> P;
+  std::vector<double> R;
+  double p_max;  // Best precision, and recall and inliers giving it
+  double r_max;
+  unsigned i_max;
+  double r_at_full_p;  // Max recall at 100% precision, and inliers giving it
+  unsigned i_at_full_p;
+};
+
+// Computes the curve from the debug output as process.m does, replaying
+// the decisions of the detector for each inliers threshold up to max_inliers
+void computePRCurve(const std::vector<DebugEntry>& entries,
+                    const GroundTruth& gt,
+                    const unsigned p,
+                    const int min_consecutive_loops,
+                    const unsigned max_inliers,
+                    const unsigned gt_neigh,
+                    const bool compensate,
+                    PRCurve* curve);
+
+}  // namespace ibow_lcd
+
+#endif  // EVALUATION_PRECISION_RECALL_H_
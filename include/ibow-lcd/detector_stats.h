@@ -0,0 +1,102 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INCLUDE_IBOW_LCD_DETECTOR_STATS_H_
+#define INCLUDE_IBOW_LCD_DETECTOR_STATS_H_
+
+#include <chrono>
+
+namespace ibow_lcd {
+
+// LCDetectorStage
+enum LCDetectorStage {
+  STAGE_SEARCH_DESCRIPTORS,  // Query descriptors against the index
+  STAGE_SEARCH_IMAGES,  // Scoring the images of the index
+  STAGE_INSERT_IMAGE,  // Adding an image to the index (synchronous only)
+  STAGE_ISLANDS,  // Filtering the candidates and building the islands
+  STAGE_MATCHING,  // Matching the query against the candidates
+  STAGE_GEOMETRY,  // Robust estimation of the geometry
+  STAGE_TOTAL,
+  NUM_STAGES
+};
+
+inline const char* stageName(const LCDetectorStage stage) {
+  static const char* names[NUM_STAGES] = {"search_descriptors",
+                                          "search_images",
+                                          "insert_image",
+                                          "islands",
+                                          "matching",
+                                          "geometry",
+                                          "total"};
+  return names[stage];
+}
+
+// LCDetectorStats: times (ms) and counters of an image. When several
+// candidates are verified, their times and matches are added up.
+struct LCDetectorStats {
+  LCDetectorStats() :
+    image_id(0),
+    candidates(0),
+    islands(0),
+    putative_matches(0),
+    inliers(0),
+    vocabulary_size(0) {
+    for (unsigned i = 0; i < NUM_STAGES; i++) {
+      time[i] = 0.0;
+    }
+  }
+
+  unsigned image_id;
+  double time[NUM_STAGES];
+  unsigned candidates;  // Images returned by the index
+  unsigned islands;
+  unsigned putative_matches;  // Matches passed to the geometric verifier
+  unsigned inliers;
+  unsigned vocabulary_size;  // Descriptors in the index
+};
+
+// StageTimer: adds the time spent in its scope to a stage. It does nothing
+// if no stats are given.
+class StageTimer {
+ public:
+  StageTimer(LCDetectorStats* stats, const LCDetectorStage stage) :
+      stats_(stats),
+      stage_(stage) {
+    if (stats_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~StageTimer() {
+    if (stats_) {
+      auto end = std::chrono::steady_clock::now();
+      stats_->time[stage_] +=
+                std::chrono::duration<double, std::milli>(end - start_).count();
+    }
+  }
+
+ private:
+  LCDetectorStats* stats_;
+  LCDetectorStage stage_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace ibow_lcd
+
+#endif  // INCLUDE_IBOW_LCD_DETECTOR_STATS_H_
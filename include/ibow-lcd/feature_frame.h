@@ -0,0 +1,43 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef INCLUDE_IBOW_LCD_FEATURE_FRAME_H_
+#define INCLUDE_IBOW_LCD_FEATURE_FRAME_H_
+
+#include <memory>
+#include <vector>
+
+#include <opencv2/features2d.hpp>
+
+namespace ibow_lcd {
+
+// FeatureFrame: an image of the sequence already described
+struct FeatureFrame {
+  unsigned image_id;
+  std::vector<cv::KeyPoint> kps;
+  cv::Mat descs;
+};
+
+// Frames are shared, instead of copied, by the stages that keep them
+typedef std::shared_ptr<const FeatureFrame> FeatureFramePtr;
+
+}  // namespace ibow_lcd
+
+#endif  // INCLUDE_IBOW_LCD_FEATURE_FRAME_H_
@@ -0,0 +1,78 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INCLUDE_IBOW_LCD_FEATURE_PIPELINE_H_
+#define INCLUDE_IBOW_LCD_FEATURE_PIPELINE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <opencv2/features2d.hpp>
+
+#include "ibow-lcd/feature_frame.h"
+
+namespace ibow_lcd {
+
+// FeaturePipeline: describes a sequence of images in the background. One
+// thread decodes the images ahead and a pool of workers extracts the
+// features, while next() delivers the frames in order. At most max_frames
+// images are in flight, so memory does not grow if the consumer is slower.
+class FeaturePipeline {
+ public:
+  // Creates a new detector for each worker, since they are not thread-safe
+  typedef std::function<cv::Ptr<cv::Feature2D>()> DetectorFactory;
+
+  FeaturePipeline(const std::vector<std::string>& filenames,
+                  const DetectorFactory& factory,
+                  const unsigned nworkers = 0,  // 0 = as many as cores
+                  const unsigned max_frames = 16);
+  virtual ~FeaturePipeline();
+
+  // Blocks until the next frame is ready. Returns false at the end.
+  bool next(FeatureFrame* frame);
+
+ private:
+  std::vector<std::string> filenames_;
+  DetectorFactory factory_;
+  unsigned max_frames_;
+  unsigned next_decode_;  // Next image to be decoded
+  unsigned next_out_;  // Next frame to be delivered
+  bool stop_;
+
+  std::deque<std::pair<unsigned, cv::Mat> > decoded_;
+  std::map<unsigned, FeatureFrame> ready_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::thread decoder_;
+  std::vector<std::thread> workers_;
+
+  void decode();
+  void extract();
+};
+
+}  // namespace ibow_lcd
+
+#endif  // INCLUDE_IBOW_LCD_FEATURE_PIPELINE_H_
@@ -0,0 +1,157 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INCLUDE_IBOW_LCD_GEOMETRIC_VERIFIER_H_
+#define INCLUDE_IBOW_LCD_GEOMETRIC_VERIFIER_H_
+
+#include <memory>
+#include <vector>
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/core.hpp>
+
+namespace ibow_lcd {
+
+// VerifierType
+enum VerifierType {
+  VERIFIER_FUNDAMENTAL,             // cv::findFundamentalMat with FM_RANSAC
+  VERIFIER_FUNDAMENTAL_PREEMPTIVE,  // Own RANSAC with early termination
+  VERIFIER_HOMOGRAPHY_PROSAC,       // cv::findHomography with RHO (PROSAC)
+  VERIFIER_ESSENTIAL                // cv::findEssentialMat, needs intrinsics
+};
+
+// VerifierParams
+struct VerifierParams {
+  VerifierParams() :
+    type(VERIFIER_FUNDAMENTAL),
+    ep_dist(2.0),
+    conf_prob(0.985),
+    max_iters(1000),
+    min_inliers(0),
+    focal_length(0.0),
+    pp(0.0, 0.0) {}
+
+  VerifierType type;  // Backend used to verify the loops
+  double ep_dist;  // Inlier threshold in pixels
+  double conf_prob;  // Confidence probability
+  unsigned max_iters;  // Max RANSAC iterations of the own implementation
+  unsigned min_inliers;  // Stop once more inliers are found (0 = count all)
+  double focal_length;  // Focal length in pixels (0 = unknown intrinsics)
+  cv::Point2d pp;  // Principal point
+};
+
+// GeometricVerifier: counts the matches consistent with a geometric model
+// estimated robustly between two images. Implementations must be safe to use
+// from several threads at the same time.
+class GeometricVerifier {
+ public:
+  virtual ~GeometricVerifier() {}
+
+  // The mask is only storage for the inliers, reused between calls
+  virtual unsigned countInliers(const std::vector<cv::Point2f>& query,
+                                const std::vector<cv::Point2f>& train,
+                                std::vector<uchar>* mask) const = 0;
+  virtual const char* name() const = 0;
+
+  // True if the matches should be sorted by distance, best first
+  virtual bool sortedMatches() const { return false; }
+};
+
+// Baseline: RANSAC over the fundamental matrix as done by OpenCV
+class FundamentalVerifier : public GeometricVerifier {
+ public:
+  explicit FundamentalVerifier(const VerifierParams& params);
+
+  unsigned countInliers(const std::vector<cv::Point2f>& query,
+                        const std::vector<cv::Point2f>& train,
+                        std::vector<uchar>* mask) const;
+  inline const char* name() const { return "Fundamental"; }
+
+ private:
+  double ep_dist_;
+  double conf_prob_;
+};
+
+// RANSAC over the fundamental matrix which updates the number of iterations
+// from the best hypothesis found so far and stops scoring a hypothesis as soon
+// as it cannot beat the best one. If min_inliers is set, it returns as soon as
+// a hypothesis has more inliers than that, so the count is only a lower bound.
+class PreemptiveFundamentalVerifier : public GeometricVerifier {
+ public:
+  explicit PreemptiveFundamentalVerifier(const VerifierParams& params);
+
+  unsigned countInliers(const std::vector<cv::Point2f>& query,
+                        const std::vector<cv::Point2f>& train,
+                        std::vector<uchar>* mask) const;
+  inline const char* name() const { return "FundamentalPreemptive"; }
+
+ private:
+  double ep_dist_;
+  double conf_prob_;
+  unsigned max_iters_;
+  unsigned min_inliers_;
+
+  unsigned scoreModel(const cv::Mat& F,
+                      const std::vector<cv::Point2f>& query,
+                      const std::vector<cv::Point2f>& train,
+                      const unsigned best,
+                      const unsigned target) const;
+};
+
+// PROSAC over a homography. Only valid when the scene is far away or the
+// camera motion is mostly a rotation, but much cheaper than the others.
+class HomographyVerifier : public GeometricVerifier {
+ public:
+  explicit HomographyVerifier(const VerifierParams& params);
+
+  unsigned countInliers(const std::vector<cv::Point2f>& query,
+                        const std::vector<cv::Point2f>& train,
+                        std::vector<uchar>* mask) const;
+  inline const char* name() const { return "HomographyPROSAC"; }
+  inline bool sortedMatches() const { return true; }
+
+ private:
+  double ep_dist_;
+  double conf_prob_;
+};
+
+// RANSAC over the essential matrix, for calibrated cameras
+class EssentialVerifier : public GeometricVerifier {
+ public:
+  explicit EssentialVerifier(const VerifierParams& params);
+
+  unsigned countInliers(const std::vector<cv::Point2f>& query,
+                        const std::vector<cv::Point2f>& train,
+                        std::vector<uchar>* mask) const;
+  inline const char* name() const { return "Essential"; }
+
+ private:
+  double ep_dist_;
+  double conf_prob_;
+  double focal_length_;
+  cv::Point2d pp_;
+};
+
+// Creates the verifier described by the params. The essential matrix falls
+// back to the fundamental one if the intrinsics are unknown.
+std::shared_ptr<GeometricVerifier> createVerifier(const VerifierParams& params);
+
+}  // namespace ibow_lcd
+
+#endif  // INCLUDE_IBOW_LCD_GEOMETRIC_VERIFIER_H_
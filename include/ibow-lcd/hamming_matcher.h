@@ -0,0 +1,69 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INCLUDE_IBOW_LCD_HAMMING_MATCHER_H_
+#define INCLUDE_IBOW_LCD_HAMMING_MATCHER_H_
+
+#include <vector>
+
+#include <opencv2/features2d.hpp>
+
+namespace ibow_lcd {
+
+// BFMatcherType
+enum BFMatcherType {
+  BF_MATCHER_OPENCV,  // cv::BFMatcher with NORM_HAMMING
+  BF_MATCHER_SCALAR,  // Own kernel using 64-bit popcounts
+  BF_MATCHER_SIMD     // Own kernel using AVX2 / AVX-512, if compiled in
+};
+
+// Returns the name of the SIMD kernel compiled into the library
+const char* hammingKernelName();
+
+// Brute-force 2-NN matching of binary descriptors. The ratio test is applied
+// as the distances are computed, so only the accepted matches are stored.
+void ratioMatchHamming(const cv::Mat& query,
+                       const cv::Mat& train,
+                       const float nndr,
+                       const BFMatcherType type,
+                       std::vector<cv::DMatch>* matches);
+
+// GuidedMatchingGrid: buckets of the train keypoints for guided matching.
+// Kept by the caller between calls to reuse its storage.
+struct GuidedMatchingGrid {
+  std::vector<int> cell_start;  // First keypoint of each cell in cells
+  std::vector<int> cell_pos;
+  std::vector<int> cells;  // Keypoints sorted by cell
+};
+
+// Same as above, but each query descriptor is only compared against the train
+// descriptors located within a radius of its predicted position. Query points
+// without a finite prediction are not matched.
+void guidedRatioMatchHamming(const cv::Mat& query,
+                             const std::vector<cv::Point2f>& predicted,
+                             const cv::Mat& train,
+                             const std::vector<cv::Point2f>& train_pts,
+                             const float radius,
+                             const float nndr,
+                             GuidedMatchingGrid* grid,
+                             std::vector<cv::DMatch>* matches);
+
+}  // namespace ibow_lcd
+
+#endif  // INCLUDE_IBOW_LCD_HAMMING_MATCHER_H_
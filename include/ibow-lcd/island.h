@@ -79,6 +79,10 @@ struct Island {
     score = score / size();
   }
 
+  void normalizeScore(const unsigned nimages) {
+    score = score / nimages;
+  }
+
   std::string toString() const {
     std::stringstream ss;
     ss << "[" << min_img_id << " - " << max_img_id << "] Score: " << score
@@ -0,0 +1,54 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef INCLUDE_IBOW_LCD_ISLAND_BUILDER_H_
+#define INCLUDE_IBOW_LCD_ISLAND_BUILDER_H_
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "ibow-lcd/island.h"
+#include "obindex2/binary_index.h"
+
+namespace ibow_lcd {
+
+// IslandBuilder: groups the candidates of a query into islands. Islands are
+// disjoint ranges of image ids, so they are kept sorted by their first id
+// and each candidate is placed with a binary search instead of checking
+// every island. The buffers are reused between queries.
+class IslandBuilder {
+ public:
+  // The candidates should be sorted by decreasing score. Each representative
+  // of skipped images, if given, extends its island up to the last of them,
+  // but the island score is still normalized by its unextended size.
+  void build(const std::vector<obindex2::ImageMatch>& image_matches,
+             const unsigned island_offset,
+             const std::map<unsigned, unsigned>* represented,
+             std::vector<Island>* islands);
+
+ private:
+  std::vector<std::pair<unsigned, unsigned> > sorted_;  // First id, island
+  std::vector<unsigned> sizes_;  // Island sizes, without the skipped images
+};
+
+}  // namespace ibow_lcd
+
+#endif  // INCLUDE_IBOW_LCD_ISLAND_BUILDER_H_
@@ -0,0 +1,118 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INCLUDE_IBOW_LCD_KEYFRAME_STORE_H_
+#define INCLUDE_IBOW_LCD_KEYFRAME_STORE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <opencv2/features2d.hpp>
+
+namespace ibow_lcd {
+
+// Keyframe: the data required to verify a loop against a previous image.
+// Only the positions of the keypoints are kept.
+struct Keyframe {
+  std::vector<cv::Point2f> pts;
+  cv::Mat descs;
+
+  inline size_t bytes() const {
+    return pts.size() * sizeof(cv::Point2f) + descs.total() * descs.elemSize();
+  }
+};
+
+// KeyframeStore: keeps the keyframes of the sequence under a memory budget.
+// When the budget is exceeded, the least recently used keyframes are spilled
+// to disk (or dropped if no spill directory is given) and reloaded on demand.
+// It can be accessed from several threads. Disk accesses are done without
+// holding the lock, so they only block the threads needing the same keyframe.
+class KeyframeStore {
+ public:
+  explicit KeyframeStore(const size_t budget = 0,
+                         const std::string& spill_dir = "");
+  virtual ~KeyframeStore();
+
+  // Both return the stored keyframe, which owns a copy of the descriptors
+  // and stays valid even if it is spilled
+  std::shared_ptr<const Keyframe> add(const unsigned image_id,
+                                      const std::vector<cv::KeyPoint>& kps,
+                                      const cv::Mat& descs);
+  std::shared_ptr<const Keyframe> add(const unsigned image_id,
+                                      const std::vector<cv::Point2f>& pts,
+                                      const cv::Mat& descs);
+  std::shared_ptr<const Keyframe> get(const unsigned image_id);
+  void remove(const unsigned image_id);
+  std::vector<unsigned> keyframeIds();
+
+  unsigned numKeyframes() const;
+  inline size_t memUsage() const { return mem_bytes_; }
+  inline unsigned long numHits() const { return hits_; }
+  inline unsigned long numMisses() const { return misses_; }
+  inline unsigned long numSpills() const { return spills_; }
+
+ private:
+  struct Entry {
+    Entry() : on_disk(false), loading(false) {}
+
+    std::shared_ptr<const Keyframe> kf;  // Null if not in memory
+    std::shared_ptr<const Keyframe> spilling;  // Being written to disk
+    bool on_disk;
+    bool loading;  // Being reloaded from disk by some thread
+    std::list<unsigned>::iterator lru_it;
+  };
+
+  // Keyframes to be written once the lock is released
+  typedef std::vector<std::pair<unsigned, std::shared_ptr<const Keyframe> > >
+                                                                  SpillList;
+
+  size_t budget_;  // Max bytes of keyframes kept in memory (0 = unlimited)
+  std::string spill_dir_;
+  std::atomic<size_t> mem_bytes_;
+  std::atomic<unsigned long> hits_;
+  std::atomic<unsigned long> misses_;
+  std::atomic<unsigned long> spills_;
+  std::atomic<unsigned long> tmp_files_;
+
+  std::unordered_map<unsigned, Entry> entries_;
+  std::list<unsigned> lru_;  // In-memory keyframes, most recent first
+  mutable std::mutex mutex_;
+  std::condition_variable loaded_;
+
+  std::shared_ptr<const Keyframe> store(const unsigned image_id,
+                                        const std::shared_ptr<Keyframe>& kf);
+  void touch(Entry* entry);
+  void erase(const unsigned image_id);
+  void enforceBudget(SpillList* spilled);
+  void writeSpilled(const SpillList& spilled);
+  std::string filename(const unsigned image_id) const;
+  bool writeKeyframe(const unsigned image_id, const Keyframe& kf);
+  std::shared_ptr<const Keyframe> readKeyframe(const unsigned image_id) const;
+};
+
+}  // namespace ibow_lcd
+
+#endif  // INCLUDE_IBOW_LCD_KEYFRAME_STORE_H_
@@ -21,20 +21,47 @@
 #define INCLUDE_IBOW_LCD_LCDETECTOR_H_
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <queue>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <sstream>
+#include <stdexcept>
+#include <unordered_map>
 #include <vector>
 
+#include "ibow-lcd/detector_stats.h"
+#include "ibow-lcd/feature_frame.h"
+#include "ibow-lcd/geometric_verifier.h"
+#include "ibow-lcd/hamming_matcher.h"
 #include "ibow-lcd/island.h"
+#include "ibow-lcd/island_builder.h"
+#include "ibow-lcd/keyframe_store.h"
+#include "ibow-lcd/shared_index.h"
+#include "ibow-lcd/worker_thread.h"
 #include "obindex2/binary_index.h"
 
 namespace ibow_lcd {
 
+// Point correspondences between the query and each indexed image
+typedef std::unordered_map<unsigned, obindex2::PointMatches> PointMatchesMap;
+
+// ForgetPolicy: images dropped from the index once it reaches its capacity
+enum ForgetPolicy {
+  FORGET_NONE,  // The index grows without bounds
+  FORGET_OLDEST,  // Sliding window over the most recent images
+  FORGET_DECIMATE  // The oldest half is thinned to one image per island
+};
+
 // LCDetectorParams
 struct LCDetectorParams {
   LCDetectorParams() :
@@ -53,7 +80,28 @@ struct LCDetectorParams {
     island_size(7),
     min_inliers(22),
     nframes_after_lc(3),
-    min_consecutive_loops(5) {}
+    min_consecutive_loops(5),
+    reuse_query_search(false),
+    async_insertion(false),
+    batch_size(64),
+    max_verified_islands(1),
+    bf_matcher(BF_MATCHER_OPENCV),
+    guided_matching(false),
+    guided_radius(40.0f),
+    verifier(VERIFIER_FUNDAMENTAL),
+    focal_length(0.0),
+    pp_x(0.0),
+    pp_y(0.0),
+    early_exit_verification(false),
+    collect_stats(false),
+    kf_budget(0),
+    kf_spill_dir(""),
+    forget_policy(FORGET_NONE),
+    max_indexed_images(0),
+    forget_step(500),
+    redundancy_ratio(0.0f),
+    snapshots(false),
+    session_id(0) {}
 
   // Image index params
   unsigned k;  // Branching factor for the image index
@@ -74,6 +122,35 @@ struct LCDetectorParams {
   unsigned min_inliers;  // Minimum number of inliers to consider a loop
   unsigned nframes_after_lc;  // Number of frames after a lc to wait for new lc
   int min_consecutive_loops;  // Min consecutive loops to avoid ep. geometry
+  bool reuse_query_search;  // Reuse the query search to insert? Approximate
+  bool async_insertion;  // Insert images into the index in the background?
+  unsigned batch_size;  // Images processed together by processBatch
+  unsigned max_verified_islands;  // Islands verified in parallel per image
+  BFMatcherType bf_matcher;  // Brute-force matcher used to verify loops
+  bool guided_matching;  // Restrict matching around the predicted positions?
+  float guided_radius;  // Search radius (px) of guided matching, in [1, 1000]
+  VerifierType verifier;  // Robust estimator used to verify the loops
+  double focal_length;  // Focal length (px) for the essential matrix
+  double pp_x;  // Principal point, x coordinate
+  double pp_y;  // Principal point, y coordinate
+  bool early_exit_verification;  // Stop verifying once the result is known?
+  bool collect_stats;  // Record times and counters of each image?
+
+  // Keyframe store params
+  unsigned kf_budget;  // Memory budget for keyframes in MB (0 = unlimited)
+  std::string kf_spill_dir;  // Dir to spill keyframes to (empty = drop them)
+
+  // Lifelong params
+  ForgetPolicy forget_policy;  // Images dropped when the index is full
+  unsigned max_indexed_images;  // Capacity of the index (0 = unlimited)
+  unsigned forget_step;  // Images indexed over capacity before rebuilding
+  float redundancy_ratio;  // Matched features ratio to skip an image (0 = off)
+
+  // Snapshot params
+  bool snapshots;  // Record the insertions into the index to allow save()?
+
+  // Multi-session params
+  unsigned session_id;  // Session of the images (up to kMaxSessionId)
 };
 
 // LCDetectorStatus
@@ -91,7 +168,8 @@ struct LCDetectorResult {
   LCDetectorResult() :
     status(LC_NOT_DETECTED),
     query_id(1),
-    train_id(-1) {}
+    train_id(-1),
+    train_session(0) {}
 
   inline bool isLoop() {
     return status == LC_DETECTED;
@@ -100,24 +178,155 @@ struct LCDetectorResult {
   LCDetectorStatus status;
   unsigned query_id;
   unsigned train_id;
+  unsigned train_session;  // Session of the loop image, see localImageId()
   unsigned inliers;
+  std::vector<unsigned> cand_ids;  // Islands verified, up to the accepted one
+  std::vector<unsigned> cand_inliers;  // Inliers of each verified island
+};
+
+// LCDetectorTrace: how the result of an image was reached
+struct LCDetectorTrace {
+  LCDetectorTrace() :
+    min_id(0),
+    max_id(0),
+    img_id(0),
+    overlap(false),
+    assumed(false),
+    inliers(0),
+    vocabulary_size(0),
+    time(0.0) {}
+
+  unsigned min_id;  // Island of the loop candidate, 0 if there is none
+  unsigned max_id;
+  unsigned img_id;  // Best image of the island
+  bool overlap;  // Does the island overlap the last loop island?
+  bool assumed;  // Was the loop accepted without verifying it?
+  unsigned inliers;  // Inliers of the candidate, also if it was assumed
+  unsigned vocabulary_size;  // Descriptors in the index
+  double time;  // Time (ms) spent processing the image
+};
+
+class ResultSink;
+
+// LCDetectorSearch: outcome of searching the index for an image
+struct LCDetectorSearch {
+  LCDetectorSearch() :
+    enough_images(false) {}
+
+  // Drops the candidates that no min_score above the given one would accept
+  void trim(const double min_score);
+
+  bool enough_images;
+  std::vector<obindex2::ImageMatch> image_matches;
+  PointMatchesMap point_matches;
+  // Skipped images represented by the candidates when they were searched, so
+  // that their islands do not depend on the images inserted afterwards
+  std::map<unsigned, unsigned> represented;
+  LCDetectorStats stats;  // Search stages, if stats are collected
 };
 
 class LCDetector {
  public:
   explicit LCDetector(const LCDetectorParams& params);
+  // Multi-session mode: one detector per session, all of them sharing the
+  // given index. Each session can be processed from its own thread. The ids
+  // of the images are namespaced with the session, and so are the results.
+  // Snapshots, forgetting and reuse_query_search are not available.
+  // Throws std::invalid_argument if session_id is above kMaxSessionId. The
+  // images can be given either their local id, which must be below 2^24, or
+  // their id already namespaced with this session. Otherwise, std::out_of_range
+  // is thrown, since the id would collide with the ones of another image.
+  LCDetector(const LCDetectorParams& params,
+             const std::shared_ptr<SharedIndex>& shared);
   virtual ~LCDetector();
 
   void process(const unsigned image_id,
                const std::vector<cv::KeyPoint>& kps,
                const cv::Mat& descs,
                LCDetectorResult* result);
-  void debug(const unsigned image_id,
-             const std::vector<cv::KeyPoint>& kps,
+  // Same as above, but the frame is kept by reference until it is indexed
+  void process(const FeatureFramePtr& frame, LCDetectorResult* result);
+  void process(FeatureFrame&& frame, LCDetectorResult* result);
+  // Same results as calling process() for each image, but the images of a
+  // batch are verified in parallel. They are processed one by one instead
+  // when verifying several islands, forgetting images or dropping keyframes
+  // (a kf_budget without kf_spill_dir).
+  void processBatch(const std::vector<unsigned>& image_ids,
+                    const std::vector<std::vector<cv::KeyPoint> >& kps,
+                    const std::vector<cv::Mat>& descs,
+                    std::vector<LCDetectorResult>* results);
+  // process() split in two stages. Configurations that only differ in the
+  // params applied after searching the index can replay the same searches.
+  void search(const unsigned image_id,
+              const std::vector<cv::KeyPoint>& kps,
+              const cv::Mat& descs,
+              LCDetectorSearch* search_res);
+  void replay(const unsigned image_id,
+              const std::vector<cv::KeyPoint>& kps,
+              const cv::Mat& descs,
+              const LCDetectorSearch& search_res,
+              LCDetectorResult* result);
+  // Place recognition without modifying the detector (e.g. relocalization):
+  // the best indexed images are verified against the given one, which is
+  // neither indexed nor affects the next loops. It can be called from
+  // several threads while another one processes the sequence. They search
+  // the index one at a time, but verify their candidates in parallel.
+  void query(const std::vector<cv::KeyPoint>& kps,
              const cv::Mat& descs,
-             std::ofstream& out_file);
+             LCDetectorResult* result);
+
+  // Receives the result of every image processed from now on. The sink is
+  // not owned by the detector.
+  inline void setSink(ResultSink* sink) {
+    sink_ = sink;
+  }
+
+  inline unsigned sessionId() const {
+    return session_id_;
+  }
+
+  // Snapshots of the whole detector state. save() fails unless the detector
+  // was created with snapshots enabled, and replaces the file only once the
+  // snapshot is complete. load() must be called on a new detector created
+  // with the same index params used to save the snapshot, or it fails, and
+  // the detector should be discarded if it does. load() copies the keyframes
+  // and replays the insertions into the index: it skips the feature
+  // extraction and the index searches, but still costs an insertion per
+  // indexed image.
+  bool save(const std::string& filename);
+  bool load(const std::string& filename);
+
+  inline const KeyframeStore& keyframeStore() const {
+    return *kf_store_;
+  }
+
+  // Indexed image that stands for the given one, which could have been
+  // skipped as redundant
+  unsigned representative(const unsigned image_id);
+
+  // Stats of each processed image, if enabled
+  inline const std::vector<LCDetectorStats>& stats() const {
+    return stats_;
+  }
+  inline void clearStats() {
+    stats_.clear();
+  }
 
  private:
+  // Buffers of the islands and the loop verification of an image, kept
+  // between images. Images or candidates processed concurrently use
+  // different ones.
+  struct ImageBuffers {
+    std::vector<obindex2::ImageMatch> candidates;  // Filtered image matches
+    IslandBuilder builder;
+    std::vector<cv::DMatch> matches;
+    std::vector<cv::Point2f> query;  // Positions of the matches
+    std::vector<cv::Point2f> train;
+    std::vector<cv::Point2f> predicted;  // Guided matching
+    GuidedMatchingGrid grid;
+    std::vector<uchar> mask;
+  };
+
   // Parameters
   unsigned p_;
   float nndr_;
@@ -129,6 +338,12 @@ class LCDetector {
   unsigned island_offset_;
   unsigned min_inliers_;
   unsigned nframes_after_lc_;
+  bool reuse_query_search_;
+  unsigned batch_size_;
+  unsigned max_verified_islands_;
+  BFMatcherType bf_matcher_;
+  bool guided_matching_;
+  float guided_radius_;
 
   // Last loop closure detected
   LCDetectorResult last_lc_result_;
@@ -136,44 +351,218 @@ class LCDetector {
   int min_consecutive_loops_;
   int consecutive_loops_;
 
-  // Image Index
+  // Image Index, only accessed holding the mutex of the shared index. It is
+  // also used, uncontended, when the index is private to this detector.
+  std::shared_ptr<SharedIndex> shared_;
+  bool multi_session_;
+  unsigned session_id_;
   std::shared_ptr<obindex2::ImageIndex> index_;
 
+  // Background thread to insert images in asynchronous mode. Its jobs only
+  // capture the detector, so that submitting them does not allocate, and
+  // take the image to insert from here. It is never given the next one
+  // before finishing the previous one.
+  std::unique_ptr<WorkerThread> inserter_;
+  unsigned insert_id_;
+  FeatureFramePtr insert_frame_;
+
   // Queues to delay the publication of hypothesis
   std::queue<unsigned> queue_ids_;
-  std::queue<std::vector<cv::KeyPoint> > queue_kps_;
-  std::queue<cv::Mat> queue_descs_;
+  std::queue<FeatureFramePtr> queue_frames_;
 
-  std::vector<std::vector<cv::KeyPoint> > prev_kps_;
-  std::vector<cv::Mat> prev_descs_;
+  // Previous keyframes, used to verify the loop candidates
+  std::shared_ptr<KeyframeStore> kf_store_;
+  std::shared_ptr<GeometricVerifier> verifier_;
+  bool early_exit_verification_;
 
+  // Images in the index, in order of insertion
+  std::vector<unsigned> indexed_ids_;
+
+  // Insertions into the index, in order, so it can be rebuilt from a
+  // snapshot. Only recorded if snapshots are enabled, and only for the images
+  // still indexed, since forgetting rebuilds the index.
+  struct IndexInsertion {
+    unsigned image_id;
+    std::vector<cv::DMatch> matches;
+  };
+  bool snapshots_;
+  std::vector<IndexInsertion> journal_;
+
+  // Lifelong mode. The index is rebuilt from the retained keyframes, so
+  // its construction params are kept. The new index is built in the
+  // background while the current one is still used, then it catches up with
+  // the images indexed meanwhile and replaces the current one. It always
+  // does so forget_step / 2 images after the rebuild starts, waiting for it
+  // if needed, so the results do not depend on how fast it is built.
+  LCDetectorParams index_params_;
+  ForgetPolicy forget_policy_;
+  unsigned max_indexed_images_;
+  unsigned forget_step_;
+  std::unique_ptr<WorkerThread> rebuilder_;
+  bool rebuilding_;
+  std::shared_ptr<obindex2::ImageIndex> next_index_;
+  std::vector<unsigned> next_ids_;
+  std::vector<IndexInsertion> next_journal_;
+  std::vector<unsigned> forgotten_ids_;  // Removed once the index is replaced
+  // Images of a batch are searched before any of them is verified, so the
+  // forgotten keyframes are only removed after the batch is assessed
+  bool in_batch_;
+  std::vector<unsigned> dropped_ids_;
+  unsigned rebuild_start_;  // Images in indexed_ids_ when the rebuild started
+  unsigned rebuild_from_;  // First image of indexed_ids_ to catch up with
+
+  // Keyframe selection. Images whose features are mostly in the index
+  // already are not inserted, and the last indexed image stands for them.
+  float redundancy_ratio_;
+  std::map<unsigned, unsigned> represented_;  // Representative -> last image
+  std::mutex represented_mutex_;
+
+  // Stats
+  bool collect_stats_;
+  std::vector<LCDetectorStats> stats_;
+  LCDetectorStats* curr_stats_;  // Stats of the image being searched
+
+  ResultSink* sink_;
+
+  // Buffers reused between images. The insertion ones are only used by the
+  // thread inserting images, which never runs during a search. Once they
+  // have grown, the allocations of the detector itself are what an image
+  // leaves behind: its keyframe, a copy of its keypoints until it is indexed
+  // unless it is given as a FeatureFrame, and its representative if it is
+  // redundant. Not removed: the queues of pending images take a new block
+  // every few dozen images, the images represented by the candidates are
+  // copied into a map when redundancy_ratio is set, forgetting rebuilds the
+  // index, sinks keep the results, and obindex2 and OpenCV allocate
+  // internally. test_allocations checks that replaying the searches of a
+  // sequence frees nothing it allocated, and "benchmark_allocations" in the
+  // evaluator counts the allocations of process().
+  LCDetectorSearch search_res_;
+  std::vector<std::vector<cv::DMatch> > query_feats_;
+  std::vector<cv::DMatch> query_matches_;
+  std::vector<obindex2::ImageMatch> all_matches_;
+  std::vector<Island> islands_;
+  std::vector<Island> candidates_;
+  std::vector<unsigned> cand_inliers_;
+  std::vector<LCDetectorStats> cand_stats_;
+  std::vector<ImageBuffers> image_bufs_;  // One per concurrent task
+  std::vector<std::vector<cv::DMatch> > insert_feats_;
+  std::vector<cv::DMatch> insert_matches_;
+  std::vector<std::vector<cv::DMatch> > rebuild_feats_;
+  std::vector<cv::DMatch> rebuild_matches_;
+
+  LCDetectorStats* newStats(const unsigned image_id);
+  unsigned globalId(const unsigned image_id) const;
+
+  void processFrame(const unsigned image_id,
+                    const std::vector<cv::KeyPoint>& kps,
+                    const cv::Mat& descs,
+                    const FeatureFramePtr& frame,
+                    LCDetectorResult* result);
+  void searchImage(const unsigned image_id,
+                   const std::vector<cv::KeyPoint>& kps,
+                   const cv::Mat& descs,
+                   const FeatureFramePtr& frame,
+                   LCDetectorSearch* search_res);
+  bool searchCandidates(const unsigned image_id,
+                        const std::vector<cv::KeyPoint>& kps,
+                        const cv::Mat& descs,
+                        const FeatureFramePtr& frame,
+                        std::vector<obindex2::ImageMatch>* image_matches,
+                        PointMatchesMap* point_matches,
+                        std::map<unsigned, unsigned>* represented);
+  bool searchCandidatesOnce(const unsigned image_id,
+                            const std::vector<cv::KeyPoint>& kps,
+                            const cv::Mat& descs,
+                            const FeatureFramePtr& frame,
+                            std::vector<obindex2::ImageMatch>* image_matches,
+                            PointMatchesMap* point_matches,
+                            std::map<unsigned, unsigned>* represented);
+  void copyRepresented(
+      const std::vector<obindex2::ImageMatch>& image_matches,
+      std::map<unsigned, unsigned>* represented);
+  void assessSearch(const unsigned image_id,
+                    const Keyframe& query,
+                    const LCDetectorSearch& search_res,
+                    LCDetectorTrace* trace,
+                    LCDetectorResult* result);
+  void assessCandidates(const unsigned image_id,
+                        const Keyframe& query,
+                        const LCDetectorSearch& search_res,
+                        LCDetectorStats* stats,
+                        LCDetectorTrace* trace,
+                        LCDetectorResult* result);
+  void traceAssumed(const Keyframe& query,
+                    const LCDetectorSearch& search_res,
+                    LCDetectorTrace* trace);
+  void writeResult(const LCDetectorResult& result, LCDetectorTrace* trace);
+  void forgetImages();
+  void selectRetained(const std::vector<unsigned>& image_ids,
+                      std::vector<unsigned>* retained);
+  void startRebuild();
+  void reinsertImages(const std::vector<unsigned>& image_ids);
+  void finishRebuild();
+  void dropForgotten();
+  void insertNextImage();
+  void waitInsertions();
+  bool writeSnapshot(std::ofstream& out);
   void addImage(const unsigned image_id,
                 const std::vector<cv::KeyPoint>& kps,
                 const cv::Mat& descs);
+  // The following ones require holding the index mutex, unless the index
+  // is not shared yet
+  void matchIndex(obindex2::ImageIndex* index,
+                  const cv::Mat& descs,
+                  std::vector<std::vector<cv::DMatch> >* matches_feats,
+                  std::vector<cv::DMatch>* matches);
+  void insertKeyframe(const unsigned image_id,
+                      const std::vector<cv::KeyPoint>& kps,
+                      const cv::Mat& descs,
+                      const std::vector<cv::DMatch>& matches);
+  void insertImage(const unsigned image_id,
+                   const std::vector<cv::KeyPoint>& kps,
+                   const cv::Mat& descs,
+                   const std::vector<cv::DMatch>& matches);
   void filterMatches(
       const std::vector<std::vector<cv::DMatch> >& matches_feats,
       std::vector<cv::DMatch>* matches);
   void filterCandidates(
       const std::vector<obindex2::ImageMatch>& image_matches,
       std::vector<obindex2::ImageMatch>* image_matches_filt);
-  void buildIslands(
+  void getIslands(
       const std::vector<obindex2::ImageMatch>& image_matches,
-      std::vector<Island>* islands);
-  void getPriorIslands(
-      const Island& island,
-      const std::vector<Island>& islands,
-      std::vector<Island>* p_islands);
-  unsigned checkEpipolarGeometry(
-      const std::vector<cv::Point2f>& query,
-      const std::vector<cv::Point2f>& train);
+      const std::map<unsigned, unsigned>& represented,
+      ImageBuffers* bufs,
+      std::vector<Island>* islands,
+      LCDetectorStats* stats);
+  Island selectIsland(const std::vector<Island>& islands, bool* overlap);
+  unsigned verifyLoop(const Keyframe& query,
+                      const unsigned train_id,
+                      const PointMatchesMap& point_matches,
+                      ImageBuffers* bufs,
+                      LCDetectorStats* stats);
+  ImageBuffers* imageBuffers(const unsigned n);
+  int verifyIslands(const Keyframe& query,
+                    const std::vector<Island>& candidates,
+                    const PointMatchesMap& point_matches,
+                    std::vector<unsigned>* inliers,
+                    LCDetectorStats* stats);
+  void assessLoop(const unsigned best_img,
+                  const bool assumed,
+                  const unsigned inliers,
+                  LCDetectorResult* result);
+  unsigned checkEpipolarGeometry(ImageBuffers* bufs);
+  bool guidedMatching(const Keyframe& query,
+                      const Keyframe& train_kf,
+                      const obindex2::PointMatches& prior,
+                      ImageBuffers* bufs);
   void ratioMatchingBF(const cv::Mat& query,
                      const cv::Mat& train,
                      std::vector<cv::DMatch>* matches);
-  void convertPoints(const std::vector<cv::KeyPoint>& query_kps,
-                     const std::vector<cv::KeyPoint>& train_kps,
-                     const std::vector<cv::DMatch>& matches,
-                     std::vector<cv::Point2f>* query,
-                     std::vector<cv::Point2f>* train);
+  void gatherPoints(const std::vector<cv::Point2f>& query_pts,
+                    const std::vector<cv::Point2f>& train_pts,
+                    const std::vector<cv::DMatch>& matches,
+                    std::vector<cv::Point2f>* query,
+                    std::vector<cv::Point2f>* train);
 };
 
 }  // namespace ibow_lcd
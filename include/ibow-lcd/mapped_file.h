@@ -0,0 +1,50 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INCLUDE_IBOW_LCD_MAPPED_FILE_H_
+#define INCLUDE_IBOW_LCD_MAPPED_FILE_H_
+
+#include <cstddef>
+#include <string>
+
+namespace ibow_lcd {
+
+// MappedFile: read-only memory mapping of a whole file (POSIX)
+class MappedFile {
+ public:
+  MappedFile();
+  virtual ~MappedFile();
+
+  bool open(const std::string& filename);
+  void close();
+
+  inline const char* data() const { return data_; }
+  inline size_t size() const { return size_; }
+
+ private:
+  const char* data_;
+  size_t size_;
+
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+};
+
+}  // namespace ibow_lcd
+
+#endif  // INCLUDE_IBOW_LCD_MAPPED_FILE_H_
@@ -0,0 +1,108 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef INCLUDE_IBOW_LCD_RESULT_SINK_H_
+#define INCLUDE_IBOW_LCD_RESULT_SINK_H_
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "ibow-lcd/lcdetector.h"
+
+namespace ibow_lcd {
+
+// ResultSink: receives the result of each image processed by a detector,
+// along with how it was reached. write() is called out of the timed region,
+// so sinks should just store the records and format them in flush().
+class ResultSink {
+ public:
+  virtual ~ResultSink() {}
+
+  virtual void write(const LCDetectorResult& result,
+                     const LCDetectorTrace& trace) = 0;
+  virtual bool flush() { return true; }
+};
+
+// MemorySink: keeps the records in memory
+class MemorySink : public ResultSink {
+ public:
+  void write(const LCDetectorResult& result, const LCDetectorTrace& trace);
+
+  inline const std::vector<LCDetectorResult>& results() const {
+    return results_;
+  }
+  inline const std::vector<LCDetectorTrace>& traces() const {
+    return traces_;
+  }
+  inline void clear() {
+    results_.clear();
+    traces_.clear();
+  }
+
+ protected:
+  std::vector<LCDetectorResult> results_;
+  std::vector<LCDetectorTrace> traces_;
+};
+
+// TsvSink: text file with a line per image, in the format the MATLAB
+// scripts expect: min_id, max_id, img_id, overlap, inliers, vocabulary size
+// and time (ms). Only the traces are stored, and they are written in blocks
+// of buffer_size lines.
+class TsvSink : public ResultSink {
+ public:
+  explicit TsvSink(const std::string& filename,
+                   const size_t buffer_size = 1 << 14);
+  virtual ~TsvSink();
+
+  void write(const LCDetectorResult& result, const LCDetectorTrace& trace);
+  bool flush();
+
+ private:
+  std::ofstream out_;
+  size_t buffer_size_;
+  std::vector<LCDetectorTrace> traces_;
+};
+
+// BinarySink: fixed-size binary records, buffered in memory and written in
+// large blocks. The candidates verified for each image are not stored.
+class BinarySink : public ResultSink {
+ public:
+  explicit BinarySink(const std::string& filename,
+                      const size_t buffer_size = 1 << 20);
+  virtual ~BinarySink();
+
+  void write(const LCDetectorResult& result, const LCDetectorTrace& trace);
+  bool flush();
+
+  // Reads back a file written by a BinarySink
+  static bool read(const std::string& filename,
+                   std::vector<LCDetectorResult>* results,
+                   std::vector<LCDetectorTrace>* traces);
+
+ private:
+  std::ofstream out_;
+  size_t buffer_size_;
+  std::vector<char> buffer_;
+};
+
+}  // namespace ibow_lcd
+
+#endif  // INCLUDE_IBOW_LCD_RESULT_SINK_H_
@@ -0,0 +1,80 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INCLUDE_IBOW_LCD_SHARED_INDEX_H_
+#define INCLUDE_IBOW_LCD_SHARED_INDEX_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "ibow-lcd/keyframe_store.h"
+#include "obindex2/binary_index.h"
+
+namespace ibow_lcd {
+
+// Multi-session mode. Several sessions (e.g. one per robot) can share the
+// same index, so loops between them can be found. The session of an image is
+// kept in the upper bits of its id, so images of different sessions never
+// collide nor fall in the same island.
+const unsigned kSessionShift = 24;
+const unsigned kLocalIdMask = (1u << kSessionShift) - 1;
+const unsigned kMaxSessionId = ~0u >> kSessionShift;
+
+inline unsigned sessionImageId(const unsigned session,
+                               const unsigned image_id) {
+  return (session << kSessionShift) | (image_id & kLocalIdMask);
+}
+
+inline unsigned imageSession(const unsigned image_id) {
+  return image_id >> kSessionShift;
+}
+
+inline unsigned localImageId(const unsigned image_id) {
+  return image_id & kLocalIdMask;
+}
+
+struct LCDetectorParams;
+
+// Lock on the index. Searches are not read-only either, since obindex2
+// accesses its maps with operator[], so every call needs exclusive access.
+typedef std::unique_lock<std::mutex> IndexLock;
+
+// SharedIndex: the image index and the keyframes of all the sessions. The
+// index is only accessed holding its mutex. The keyframe store can be
+// accessed from several threads by itself.
+struct SharedIndex {
+  // The index and keyframe store params are taken from the given ones
+  explicit SharedIndex(const LCDetectorParams& params);
+
+  std::shared_ptr<obindex2::ImageIndex> index;
+  // obindex2 requires its images to be numbered from 0 in order of
+  // insertion, so they are added with their position here and the id of
+  // each one is kept instead
+  std::vector<unsigned> image_ids;
+  std::shared_ptr<KeyframeStore> kf_store;
+  std::mutex mutex;
+  // Descriptors in the index, updated with it but readable without the lock
+  std::atomic<unsigned> num_descriptors;
+};
+
+}  // namespace ibow_lcd
+
+#endif  // INCLUDE_IBOW_LCD_SHARED_INDEX_H_
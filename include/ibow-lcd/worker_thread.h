@@ -0,0 +1,61 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INCLUDE_IBOW_LCD_WORKER_THREAD_H_
+#define INCLUDE_IBOW_LCD_WORKER_THREAD_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ibow_lcd {
+
+// WorkerThread: runs jobs in order on a background thread. The queue of
+// pending jobs is bounded, so submit() blocks while it is full. It is a ring
+// of max_jobs slots, so only the jobs too large for the small-object buffer
+// of std::function allocate when submitted.
+class WorkerThread {
+ public:
+  explicit WorkerThread(const unsigned max_jobs = 1);
+  virtual ~WorkerThread();
+
+  void submit(const std::function<void()>& job);
+  void wait();
+  // Whether every submitted job has finished, without waiting for them
+  bool idle();
+
+ private:
+  unsigned max_jobs_;
+  bool busy_;
+  bool stop_;
+  std::vector<std::function<void()> > jobs_;
+  unsigned first_job_;
+  unsigned njobs_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::thread thread_;
+
+  void run();
+};
+
+}  // namespace ibow_lcd
+
+#endif  // INCLUDE_IBOW_LCD_WORKER_THREAD_H_
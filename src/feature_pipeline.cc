@@ -0,0 +1,139 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ibow-lcd/feature_pipeline.h"
+
+#include <utility>
+
+#include <opencv2/imgcodecs.hpp>
+
+namespace ibow_lcd {
+
+FeaturePipeline::FeaturePipeline(const std::vector<std::string>& filenames,
+                                 const DetectorFactory& factory,
+                                 const unsigned nworkers,
+                                 const unsigned max_frames) :
+    filenames_(filenames),
+    factory_(factory),
+    max_frames_(max_frames ? max_frames : 1),
+    next_decode_(0),
+    next_out_(0),
+    stop_(false) {
+  unsigned nthreads = nworkers;
+  if (!nthreads) {
+    // The decoder and the consumer take the remaining cores
+    unsigned ncores = std::thread::hardware_concurrency();
+    nthreads = ncores > 2 ? ncores - 2 : 1;
+  }
+
+  decoder_ = std::thread(&FeaturePipeline::decode, this);
+  for (unsigned i = 0; i < nthreads; i++) {
+    workers_.push_back(std::thread(&FeaturePipeline::extract, this));
+  }
+}
+
+FeaturePipeline::~FeaturePipeline() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+
+  decoder_.join();
+  for (unsigned i = 0; i < workers_.size(); i++) {
+    workers_[i].join();
+  }
+}
+
+bool FeaturePipeline::next(FeatureFrame* frame) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (next_out_ >= filenames_.size()) {
+    return false;
+  }
+
+  cond_.wait(lock, [this] { return ready_.count(next_out_) > 0; });
+  auto it = ready_.find(next_out_);
+  *frame = std::move(it->second);
+  ready_.erase(it);
+  next_out_++;
+  lock.unlock();
+
+  // A new image can be decoded
+  cond_.notify_all();
+  return true;
+}
+
+void FeaturePipeline::decode() {
+  while (true) {
+    unsigned image_id;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this] {
+        return stop_ || next_decode_ - next_out_ < max_frames_;
+      });
+      if (stop_ || next_decode_ >= filenames_.size()) {
+        return;
+      }
+      image_id = next_decode_;
+    }
+
+    cv::Mat img = cv::imread(filenames_[image_id]);
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      decoded_.push_back(std::make_pair(image_id, img));
+      next_decode_++;
+    }
+    cond_.notify_all();
+  }
+}
+
+void FeaturePipeline::extract() {
+  cv::Ptr<cv::Feature2D> detector = factory_();
+
+  while (true) {
+    std::pair<unsigned, cv::Mat> image;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this] {
+        return stop_ || !decoded_.empty() ||
+               next_decode_ >= filenames_.size();
+      });
+      if (decoded_.empty()) {
+        // Stopping or all the images have been described
+        return;
+      }
+      image = decoded_.front();
+      decoded_.pop_front();
+    }
+
+    FeatureFrame frame;
+    frame.image_id = image.first;
+    detector->detect(image.second, frame.kps);
+    detector->compute(image.second, frame.kps, frame.descs);
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      ready_[frame.image_id] = std::move(frame);
+    }
+    cond_.notify_all();
+  }
+}
+
+}  // namespace ibow_lcd
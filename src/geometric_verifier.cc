@@ -0,0 +1,250 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ibow-lcd/geometric_verifier.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace ibow_lcd {
+
+namespace {
+
+unsigned countMask(const std::vector<uchar>& mask) {
+  unsigned total = 0;
+  for (unsigned i = 0; i < mask.size(); i++) {
+    if (mask[i]) {
+      total++;
+    }
+  }
+
+  return total;
+}
+
+// Same update rule used by the RANSAC implementation of OpenCV
+unsigned updateNumIters(const double conf_prob,
+                        const double outlier_ratio,
+                        const int model_points,
+                        const unsigned max_iters) {
+  double num = std::max(1.0 - conf_prob, DBL_MIN);
+  double denom = 1.0 - std::pow(1.0 - outlier_ratio, model_points);
+  if (denom < DBL_MIN) {
+    return 0;
+  }
+
+  num = std::log(num);
+  denom = std::log(denom);
+  if (denom >= 0 || -num >= max_iters * (-denom)) {
+    return max_iters;
+  }
+
+  return static_cast<unsigned>(cvRound(num / denom));
+}
+
+}  // namespace
+
+// --- FundamentalVerifier ---
+
+FundamentalVerifier::FundamentalVerifier(const VerifierParams& params) :
+    ep_dist_(params.ep_dist),
+    conf_prob_(params.conf_prob) {}
+
+unsigned FundamentalVerifier::countInliers(
+                              const std::vector<cv::Point2f>& query,
+                              const std::vector<cv::Point2f>& train,
+                              std::vector<uchar>* mask) const {
+  std::vector<uchar>& inliers = *mask;
+  inliers.assign(query.size(), 0);
+  if (query.size() > 7) {
+    cv::findFundamentalMat(cv::Mat(query), cv::Mat(train),
+                           cv::FM_RANSAC, ep_dist_, conf_prob_, inliers);
+  }
+
+  return countMask(inliers);
+}
+
+// --- PreemptiveFundamentalVerifier ---
+
+PreemptiveFundamentalVerifier::PreemptiveFundamentalVerifier(
+                                            const VerifierParams& params) :
+    ep_dist_(params.ep_dist),
+    conf_prob_(params.conf_prob),
+    max_iters_(params.max_iters),
+    min_inliers_(params.min_inliers) {}
+
+unsigned PreemptiveFundamentalVerifier::countInliers(
+                              const std::vector<cv::Point2f>& query,
+                              const std::vector<cv::Point2f>& train,
+                              std::vector<uchar>* mask) const {
+  const unsigned npoints = query.size();
+  if (npoints <= 7) {
+    return 0;
+  }
+
+  // Fixed seed, so the result does not depend on previous calls
+  cv::RNG rng(0xffffffff);
+  cv::Point2f squery[7];
+  cv::Point2f strain[7];
+  unsigned sample[7];
+
+  // Once this number of inliers is reached the loop is already certified
+  const unsigned target = min_inliers_ ? min_inliers_ + 1 : npoints;
+
+  unsigned best = 0;
+  unsigned niters = max_iters_;
+  for (unsigned iter = 0; iter < niters; iter++) {
+    // Drawing a minimal sample of different matches
+    for (unsigned i = 0; i < 7; i++) {
+      unsigned idx;
+      do {
+        idx = rng.uniform(0, static_cast<int>(npoints));
+      } while (std::find(sample, sample + i, idx) != sample + i);
+      sample[i] = idx;
+      squery[i] = query[idx];
+      strain[i] = train[idx];
+    }
+
+    // The 7-point algorithm gives up to three solutions stacked by rows
+    cv::Mat Fs = cv::findFundamentalMat(cv::Mat(7, 1, CV_32FC2, squery),
+                                        cv::Mat(7, 1, CV_32FC2, strain),
+                                        cv::FM_7POINT);
+    for (int s = 0; s + 3 <= Fs.rows; s += 3) {
+      unsigned ninliers = scoreModel(Fs.rowRange(s, s + 3), query, train,
+                                     best, target);
+      if (ninliers >= target) {
+        return ninliers;
+      }
+      if (ninliers > best) {
+        best = ninliers;
+        double outlier_ratio = static_cast<double>(npoints - best) / npoints;
+        niters = std::min(niters, updateNumIters(conf_prob_, outlier_ratio,
+                                                 7, max_iters_));
+      }
+    }
+  }
+
+  return best;
+}
+
+unsigned PreemptiveFundamentalVerifier::scoreModel(
+                                    const cv::Mat& F,
+                                    const std::vector<cv::Point2f>& query,
+                                    const std::vector<cv::Point2f>& train,
+                                    const unsigned best,
+                                    const unsigned target) const {
+  const double* f = F.ptr<double>(0);
+  const double thresh = ep_dist_ * ep_dist_;
+  const unsigned npoints = query.size();
+
+  unsigned ninliers = 0;
+  for (unsigned i = 0; i < npoints; i++) {
+    // Not even the remaining matches would make this model the best one
+    if (ninliers + (npoints - i) <= best) {
+      return 0;
+    }
+
+    // Squared distances to the epipolar lines in both images
+    double x1 = query[i].x, y1 = query[i].y;
+    double x2 = train[i].x, y2 = train[i].y;
+
+    double a = f[0] * x1 + f[1] * y1 + f[2];
+    double b = f[3] * x1 + f[4] * y1 + f[5];
+    double c = f[6] * x1 + f[7] * y1 + f[8];
+    double d2 = a * x2 + b * y2 + c;
+    double s2 = 1.0 / (a * a + b * b);
+
+    a = f[0] * x2 + f[3] * y2 + f[6];
+    b = f[1] * x2 + f[4] * y2 + f[7];
+    double s1 = 1.0 / (a * a + b * b);
+
+    if (std::max(d2 * d2 * s1, d2 * d2 * s2) <= thresh) {
+      ninliers++;
+      if (ninliers >= target) {
+        break;
+      }
+    }
+  }
+
+  return ninliers;
+}
+
+// --- HomographyVerifier ---
+
+HomographyVerifier::HomographyVerifier(const VerifierParams& params) :
+    ep_dist_(params.ep_dist),
+    conf_prob_(params.conf_prob) {}
+
+unsigned HomographyVerifier::countInliers(
+                              const std::vector<cv::Point2f>& query,
+                              const std::vector<cv::Point2f>& train,
+                              std::vector<uchar>* mask) const {
+  std::vector<uchar>& inliers = *mask;
+  inliers.assign(query.size(), 0);
+  if (query.size() > 3) {
+    // RHO expects the matches sorted by quality, as PROSAC does
+    cv::findHomography(cv::Mat(query), cv::Mat(train), cv::RHO, ep_dist_,
+                       inliers, 2000, conf_prob_);
+  }
+
+  return countMask(inliers);
+}
+
+// --- EssentialVerifier ---
+
+EssentialVerifier::EssentialVerifier(const VerifierParams& params) :
+    ep_dist_(params.ep_dist),
+    conf_prob_(params.conf_prob),
+    focal_length_(params.focal_length),
+    pp_(params.pp) {}
+
+unsigned EssentialVerifier::countInliers(
+                              const std::vector<cv::Point2f>& query,
+                              const std::vector<cv::Point2f>& train,
+                              std::vector<uchar>* mask) const {
+  std::vector<uchar>& inliers = *mask;
+  inliers.assign(query.size(), 0);
+  if (query.size() > 4) {
+    cv::findEssentialMat(cv::Mat(query), cv::Mat(train), focal_length_, pp_,
+                         cv::RANSAC, conf_prob_, ep_dist_, inliers);
+  }
+
+  return countMask(inliers);
+}
+
+std::shared_ptr<GeometricVerifier> createVerifier(
+                                            const VerifierParams& params) {
+  switch (params.type) {
+    case VERIFIER_FUNDAMENTAL_PREEMPTIVE:
+      return std::make_shared<PreemptiveFundamentalVerifier>(params);
+    case VERIFIER_HOMOGRAPHY_PROSAC:
+      return std::make_shared<HomographyVerifier>(params);
+    case VERIFIER_ESSENTIAL:
+      if (params.focal_length > 0.0) {
+        return std::make_shared<EssentialVerifier>(params);
+      }
+      break;
+    default:
+      break;
+  }
+
+  return std::make_shared<FundamentalVerifier>(params);
+}
+
+}  // namespace ibow_lcd
@@ -0,0 +1,359 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ibow-lcd/hamming_matcher.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace ibow_lcd {
+
+namespace {
+
+inline uint64_t load64(const uchar* p) {
+  uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// Distance between two descriptors of any length
+struct HammingGeneric {
+  explicit HammingGeneric(const int n) : nbytes(n) {}
+
+  inline int operator()(const uchar* a, const uchar* b) const {
+    int dist = 0;
+    int i = 0;
+    for (; i + 8 <= nbytes; i += 8) {
+      dist += __builtin_popcountll(load64(a + i) ^ load64(b + i));
+    }
+    for (; i < nbytes; i++) {
+      dist += __builtin_popcount(a[i] ^ b[i]);
+    }
+    return dist;
+  }
+
+  int nbytes;
+};
+
+// Distance between two 256-bit descriptors (e.g. ORB)
+struct Hamming256Scalar {
+  inline int operator()(const uchar* a, const uchar* b) const {
+    return __builtin_popcountll(load64(a) ^ load64(b)) +
+           __builtin_popcountll(load64(a + 8) ^ load64(b + 8)) +
+           __builtin_popcountll(load64(a + 16) ^ load64(b + 16)) +
+           __builtin_popcountll(load64(a + 24) ^ load64(b + 24));
+  }
+};
+
+#if defined(__AVX512VPOPCNTDQ__) && defined(__AVX512VL__)
+#define IBOW_LCD_HAMMING_SIMD "AVX-512 VPOPCNTDQ"
+struct Hamming256Simd {
+  inline int operator()(const uchar* a, const uchar* b) const {
+    __m256i x = _mm256_xor_si256(
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a)),
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b)));
+    __m256i cnt = _mm256_popcnt_epi64(x);
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(cnt),
+                                _mm256_extracti128_si256(cnt, 1));
+    return static_cast<int>(_mm_cvtsi128_si64(sum) +
+                            _mm_extract_epi64(sum, 1));
+  }
+};
+#elif defined(__AVX2__)
+#define IBOW_LCD_HAMMING_SIMD "AVX2"
+struct Hamming256Simd {
+  Hamming256Simd() :
+    lookup(_mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4)),
+    low_mask(_mm256_set1_epi8(0x0f)) {}
+
+  inline int operator()(const uchar* a, const uchar* b) const {
+    // Counting the bits of each nibble with a lookup table
+    __m256i x = _mm256_xor_si256(
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a)),
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b)));
+    __m256i lo = _mm256_and_si256(x, low_mask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask);
+    __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                  _mm256_shuffle_epi8(lookup, hi));
+    // Horizontal sum of the bytes
+    __m256i sad = _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(sad),
+                                _mm256_extracti128_si256(sad, 1));
+    return static_cast<int>(_mm_cvtsi128_si64(sum) +
+                            _mm_extract_epi64(sum, 1));
+  }
+
+  __m256i lookup;
+  __m256i low_mask;
+};
+#else
+#define IBOW_LCD_HAMMING_SIMD "none"
+typedef Hamming256Scalar Hamming256Simd;
+#endif
+
+template <typename Distance>
+void ratioMatch(const cv::Mat& query,
+                const cv::Mat& train,
+                const float nndr,
+                const Distance& distance,
+                std::vector<cv::DMatch>* matches) {
+  // The ratio test needs, at least, two neighbours
+  if (train.rows < 2) {
+    return;
+  }
+
+  for (int q = 0; q < query.rows; q++) {
+    const uchar* qdesc = query.ptr(q);
+    int best = INT_MAX;
+    int second = INT_MAX;
+    int best_idx = -1;
+
+    for (int t = 0; t < train.rows; t++) {
+      int dist = distance(qdesc, train.ptr(t));
+      if (dist < best) {
+        second = best;
+        best = dist;
+        best_idx = t;
+      } else if (dist < second) {
+        second = dist;
+      }
+    }
+
+    if (static_cast<float>(best) <= static_cast<float>(second) * nndr) {
+      matches->push_back(cv::DMatch(q, best_idx, static_cast<float>(best)));
+    }
+  }
+}
+
+void ratioMatchOpenCV(const cv::Mat& query,
+                      const cv::Mat& train,
+                      const float nndr,
+                      std::vector<cv::DMatch>* matches) {
+  cv::BFMatcher matcher(cv::NORM_HAMMING);
+
+  // Matching descriptors
+  std::vector<std::vector<cv::DMatch> > matches12;
+  matcher.knnMatch(query, train, matches12, 2);
+
+  // Filtering the resulting matchings according to the given ratio
+  for (unsigned m = 0; m < matches12.size(); m++) {
+    if (matches12[m].size() < 2) {
+      continue;
+    }
+
+    if (matches12[m][0].distance <= matches12[m][1].distance * nndr) {
+      matches->push_back(matches12[m][0]);
+    }
+  }
+}
+
+// Max number of cells per side of the guided matching grid
+const int kMaxGridCells = 64;
+
+// Cells of size cell_size covering [v - radius, v + radius], clamped to
+// [0, ncells). Computed in float so that far predictions do not overflow.
+inline bool cellRange(const float v,
+                      const float radius,
+                      const float min_v,
+                      const float cell_size,
+                      const int ncells,
+                      int* c0,
+                      int* c1) {
+  float f0 = std::floor((v - radius - min_v) / cell_size);
+  float f1 = std::floor((v + radius - min_v) / cell_size);
+  if (f1 < 0.0f || f0 > static_cast<float>(ncells - 1)) {
+    return false;
+  }
+
+  *c0 = static_cast<int>(std::max(f0, 0.0f));
+  *c1 = static_cast<int>(std::min(f1, static_cast<float>(ncells - 1)));
+  return true;
+}
+
+template <typename Distance>
+void guidedRatioMatch(const cv::Mat& query,
+                      const std::vector<cv::Point2f>& predicted,
+                      const cv::Mat& train,
+                      const std::vector<cv::Point2f>& train_pts,
+                      const float radius,
+                      const float nndr,
+                      const Distance& distance,
+                      GuidedMatchingGrid* grid,
+                      std::vector<cv::DMatch>* matches) {
+  if (train_pts.size() < 2) {
+    return;
+  }
+
+  // Bounds of the train keypoints
+  float min_x = train_pts[0].x;
+  float max_x = train_pts[0].x;
+  float min_y = train_pts[0].y;
+  float max_y = train_pts[0].y;
+  for (unsigned i = 1; i < train_pts.size(); i++) {
+    min_x = std::min(min_x, train_pts[i].x);
+    max_x = std::max(max_x, train_pts[i].x);
+    min_y = std::min(min_y, train_pts[i].y);
+    max_y = std::max(max_y, train_pts[i].y);
+  }
+
+  // Bucketing the train keypoints in cells of the size of the radius, unless
+  // the grid would be too large
+  float cell_size = std::max(radius,
+                             std::max(max_x - min_x, max_y - min_y) /
+                             kMaxGridCells);
+  int ncols = std::min(static_cast<int>((max_x - min_x) / cell_size) + 1,
+                       kMaxGridCells);
+  int nrows = std::min(static_cast<int>((max_y - min_y) / cell_size) + 1,
+                       kMaxGridCells);
+  std::vector<int>& cell_start = grid->cell_start;
+  std::vector<int>& cell_pos = grid->cell_pos;
+  std::vector<int>& cells = grid->cells;
+  cell_start.assign(ncols * nrows + 1, 0);
+  cells.resize(train_pts.size());
+  for (unsigned i = 0; i < train_pts.size(); i++) {
+    int cx = std::min(static_cast<int>((train_pts[i].x - min_x) / cell_size),
+                      ncols - 1);
+    int cy = std::min(static_cast<int>((train_pts[i].y - min_y) / cell_size),
+                      nrows - 1);
+    cell_start[cy * ncols + cx + 1]++;
+  }
+  for (unsigned c = 1; c < cell_start.size(); c++) {
+    cell_start[c] += cell_start[c - 1];
+  }
+  cell_pos.assign(cell_start.begin(), cell_start.end() - 1);
+  for (unsigned i = 0; i < train_pts.size(); i++) {
+    int cx = std::min(static_cast<int>((train_pts[i].x - min_x) / cell_size),
+                      ncols - 1);
+    int cy = std::min(static_cast<int>((train_pts[i].y - min_y) / cell_size),
+                      nrows - 1);
+    cells[cell_pos[cy * ncols + cx]++] = i;
+  }
+
+  float sq_radius = radius * radius;
+  for (int q = 0; q < query.rows; q++) {
+    const cv::Point2f& pt = predicted[q];
+    if (!std::isfinite(pt.x) || !std::isfinite(pt.y)) {
+      continue;
+    }
+
+    // Cells covered by the search radius
+    int cx0, cx1, cy0, cy1;
+    if (!cellRange(pt.x, radius, min_x, cell_size, ncols, &cx0, &cx1) ||
+        !cellRange(pt.y, radius, min_y, cell_size, nrows, &cy0, &cy1)) {
+      continue;
+    }
+
+    const uchar* qdesc = query.ptr(q);
+    int best = INT_MAX;
+    int second = INT_MAX;
+    int best_idx = -1;
+
+    for (int cy = cy0; cy <= cy1; cy++) {
+      for (int cx = cx0; cx <= cx1; cx++) {
+        int cell = cy * ncols + cx;
+        for (int k = cell_start[cell]; k < cell_start[cell + 1]; k++) {
+          int t = cells[k];
+          float dx = train_pts[t].x - pt.x;
+          float dy = train_pts[t].y - pt.y;
+          if (dx * dx + dy * dy > sq_radius) {
+            continue;
+          }
+
+          int dist = distance(qdesc, train.ptr(t));
+          if (dist < best) {
+            second = best;
+            best = dist;
+            best_idx = t;
+          } else if (dist < second) {
+            second = dist;
+          }
+        }
+      }
+    }
+
+    // A second neighbour is required to apply the ratio test
+    if (second != INT_MAX &&
+        static_cast<float>(best) <= static_cast<float>(second) * nndr) {
+      matches->push_back(cv::DMatch(q, best_idx, static_cast<float>(best)));
+    }
+  }
+}
+
+}  // namespace
+
+const char* hammingKernelName() {
+  return IBOW_LCD_HAMMING_SIMD;
+}
+
+void ratioMatchHamming(const cv::Mat& query,
+                       const cv::Mat& train,
+                       const float nndr,
+                       const BFMatcherType type,
+                       std::vector<cv::DMatch>* matches) {
+  matches->clear();
+
+  // Only byte descriptors of the same size can be handled by our kernels
+  bool supported = query.type() == CV_8U && train.type() == CV_8U &&
+                   query.cols == train.cols;
+
+  if (type == BF_MATCHER_OPENCV || !supported) {
+    ratioMatchOpenCV(query, train, nndr, matches);
+  } else if (query.cols != 32) {
+    ratioMatch(query, train, nndr, HammingGeneric(query.cols), matches);
+  } else if (type == BF_MATCHER_SIMD) {
+    ratioMatch(query, train, nndr, Hamming256Simd(), matches);
+  } else {
+    ratioMatch(query, train, nndr, Hamming256Scalar(), matches);
+  }
+}
+
+void guidedRatioMatchHamming(const cv::Mat& query,
+                             const std::vector<cv::Point2f>& predicted,
+                             const cv::Mat& train,
+                             const std::vector<cv::Point2f>& train_pts,
+                             const float radius,
+                             const float nndr,
+                             GuidedMatchingGrid* grid,
+                             std::vector<cv::DMatch>* matches) {
+  matches->clear();
+
+  bool supported = query.type() == CV_8U && train.type() == CV_8U &&
+                   query.cols == train.cols && radius > 0.0f &&
+                   std::isfinite(radius);
+
+  if (!supported) {
+    ratioMatchOpenCV(query, train, nndr, matches);
+  } else if (query.cols != 32) {
+    guidedRatioMatch(query, predicted, train, train_pts, radius, nndr,
+                     HammingGeneric(query.cols), grid, matches);
+  } else {
+    guidedRatioMatch(query, predicted, train, train_pts, radius, nndr,
+                     Hamming256Simd(), grid, matches);
+  }
+}
+
+}  // namespace ibow_lcd
@@ -0,0 +1,91 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "ibow-lcd/island_builder.h"
+
+#include <algorithm>
+
+#include "ibow-lcd/shared_index.h"
+
+namespace ibow_lcd {
+
+void IslandBuilder::build(
+      const std::vector<obindex2::ImageMatch>& image_matches,
+      const unsigned island_offset,
+      const std::map<unsigned, unsigned>* represented,
+      std::vector<Island>* islands) {
+  islands->clear();
+  sorted_.clear();
+  sizes_.clear();
+
+  // We process each of the resulting image matchings
+  for (unsigned i = 0; i < image_matches.size(); i++) {
+    // Getting information about this match
+    unsigned curr_img_id = static_cast<unsigned>(image_matches[i].image_id);
+    double curr_score = image_matches[i].score;
+
+    // Theoretical island limits, which never cross into another session
+    unsigned local_id = localImageId(curr_img_id);
+    unsigned min_id = curr_img_id - std::min(local_id, island_offset);
+    unsigned max_id = curr_img_id + std::min(kLocalIdMask - local_id,
+                                             island_offset);
+    unsigned last_id = max_id;
+    if (represented) {
+      auto rep = represented->find(curr_img_id);
+      if (rep != represented->end()) {
+        max_id = std::max(max_id, rep->second);
+      }
+    }
+
+    // First island starting after the image
+    auto next = std::upper_bound(sorted_.begin(), sorted_.end(),
+                                 std::make_pair(curr_img_id, ~0u));
+
+    // The image can only belong to the previous island. Otherwise, the new
+    // island is limited by the closest islands at both sides.
+    if (next != sorted_.begin()) {
+      Island& prev = islands->at((next - 1)->second);
+      if (prev.fits(curr_img_id)) {
+        prev.incrementScore(curr_score);
+        continue;
+      }
+      min_id = std::max(min_id, prev.max_img_id + 1);
+    }
+    if (next != sorted_.end()) {
+      max_id = std::min(max_id, islands->at(next->second).min_img_id - 1);
+      last_id = std::min(last_id, max_id);
+    }
+
+    // Creating a new island
+    sorted_.insert(next, std::make_pair(min_id, islands->size()));
+    islands->push_back(Island(curr_img_id, curr_score, min_id, max_id));
+    sizes_.push_back(last_id - min_id + 1);
+  }
+
+  // Normalizing the final scores according to the number of images. The
+  // skipped images are not counted, since they never score.
+  for (unsigned j = 0; j < islands->size(); j++) {
+    islands->at(j).normalizeScore(sizes_[j]);
+  }
+
+  std::sort(islands->begin(), islands->end());
+}
+
+}  // namespace ibow_lcd
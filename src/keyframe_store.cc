@@ -0,0 +1,351 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ibow-lcd/keyframe_store.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+namespace ibow_lcd {
+
+KeyframeStore::KeyframeStore(const size_t budget,
+                             const std::string& spill_dir) :
+    budget_(budget),
+    spill_dir_(spill_dir),
+    mem_bytes_(0),
+    hits_(0),
+    misses_(0),
+    spills_(0),
+    tmp_files_(0) {
+  if (!spill_dir_.empty()) {
+    boost::filesystem::create_directories(spill_dir_);
+  }
+}
+
+KeyframeStore::~KeyframeStore() {
+  // Removing the keyframes spilled to disk
+  for (auto it = entries_.begin(); it != entries_.end(); it++) {
+    if (it->second.on_disk) {
+      std::remove(filename(it->first).c_str());
+    }
+  }
+}
+
+std::shared_ptr<const Keyframe> KeyframeStore::add(
+                                        const unsigned image_id,
+                                        const std::vector<cv::KeyPoint>& kps,
+                                        const cv::Mat& descs) {
+  // Packing the keypoint positions
+  std::shared_ptr<Keyframe> kf = std::make_shared<Keyframe>();
+  kf->pts.resize(kps.size());
+  for (unsigned i = 0; i < kps.size(); i++) {
+    kf->pts[i] = kps[i].pt;
+  }
+  kf->descs = descs.clone();
+
+  return store(image_id, kf);
+}
+
+std::shared_ptr<const Keyframe> KeyframeStore::add(
+                                        const unsigned image_id,
+                                        const std::vector<cv::Point2f>& pts,
+                                        const cv::Mat& descs) {
+  std::shared_ptr<Keyframe> kf = std::make_shared<Keyframe>();
+  kf->pts = pts;
+  kf->descs = descs.clone();
+
+  return store(image_id, kf);
+}
+
+std::shared_ptr<const Keyframe> KeyframeStore::get(const unsigned image_id) {
+  std::shared_ptr<const Keyframe> kf;
+  SpillList spilled;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = entries_.find(image_id);
+    while (it != entries_.end() && it->second.loading) {
+      // Another thread is reloading it
+      loaded_.wait(lock);
+      it = entries_.find(image_id);
+    }
+
+    if (it == entries_.end()) {
+      // This keyframe was dropped or never added
+      misses_++;
+      return kf;
+    }
+
+    if (it->second.kf) {
+      hits_++;
+      touch(&it->second);
+      return it->second.kf;
+    }
+
+    if (it->second.spilling) {
+      // It is still in memory while it is written, so it is taken back
+      hits_++;
+      kf = it->second.spilling;
+      it->second.spilling.reset();
+    } else {
+      // The keyframe has to be reloaded from disk
+      misses_++;
+      it->second.loading = true;
+      lock.unlock();
+      kf = readKeyframe(image_id);
+      lock.lock();
+
+      it = entries_.find(image_id);
+      if (it != entries_.end()) {
+        it->second.loading = false;
+      }
+      loaded_.notify_all();
+
+      // It could have been removed or replaced meanwhile
+      if (!kf || it == entries_.end()) {
+        return kf;
+      }
+      if (it->second.kf) {
+        return it->second.kf;
+      }
+    }
+
+    Entry& entry = it->second;
+    entry.kf = kf;
+    lru_.push_front(image_id);
+    entry.lru_it = lru_.begin();
+    mem_bytes_ += kf->bytes();
+    enforceBudget(&spilled);
+  }
+  writeSpilled(spilled);
+
+  return kf;
+}
+
+unsigned KeyframeStore::numKeyframes() const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+void KeyframeStore::remove(const unsigned image_id) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  erase(image_id);
+}
+
+std::vector<unsigned> KeyframeStore::keyframeIds() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::vector<unsigned> ids;
+  ids.reserve(entries_.size());
+  for (auto it = entries_.begin(); it != entries_.end(); it++) {
+    ids.push_back(it->first);
+  }
+  std::sort(ids.begin(), ids.end());
+
+  return ids;
+}
+
+std::shared_ptr<const Keyframe> KeyframeStore::store(
+                                        const unsigned image_id,
+                                        const std::shared_ptr<Keyframe>& kf) {
+  SpillList spilled;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    // Replacing a previous keyframe with the same id, if any
+    erase(image_id);
+
+    Entry& entry = entries_[image_id];
+    entry.kf = kf;
+    lru_.push_front(image_id);
+    entry.lru_it = lru_.begin();
+    mem_bytes_ += kf->bytes();
+
+    enforceBudget(&spilled);
+  }
+  writeSpilled(spilled);
+
+  return kf;
+}
+
+void KeyframeStore::touch(Entry* entry) {
+  lru_.splice(lru_.begin(), lru_, entry->lru_it);
+  entry->lru_it = lru_.begin();
+}
+
+void KeyframeStore::erase(const unsigned image_id) {
+  auto it = entries_.find(image_id);
+  if (it == entries_.end()) {
+    return;
+  }
+
+  if (it->second.kf) {
+    mem_bytes_ -= it->second.kf->bytes();
+    lru_.erase(it->second.lru_it);
+  }
+  if (it->second.on_disk) {
+    std::remove(filename(image_id).c_str());
+  }
+  entries_.erase(it);
+}
+
+void KeyframeStore::enforceBudget(SpillList* spilled) {
+  // The most recently used keyframe is always kept in memory
+  while (budget_ && mem_bytes_ > budget_ && lru_.size() > 1) {
+    unsigned image_id = lru_.back();
+    auto it = entries_.find(image_id);
+    Entry& entry = it->second;
+
+    mem_bytes_ -= entry.kf->bytes();
+    lru_.pop_back();
+    spills_++;
+
+    if (!spill_dir_.empty() && !entry.on_disk) {
+      // It is written once the lock is released
+      entry.spilling = entry.kf;
+      spilled->push_back(std::make_pair(image_id, entry.kf));
+      entry.kf.reset();
+    } else if (entry.on_disk) {
+      entry.kf.reset();
+    } else {
+      entries_.erase(it);
+    }
+  }
+}
+
+void KeyframeStore::writeSpilled(const SpillList& spilled) {
+  for (unsigned i = 0; i < spilled.size(); i++) {
+    unsigned image_id = spilled[i].first;
+    const std::shared_ptr<const Keyframe>& kf = spilled[i].second;
+    bool written = writeKeyframe(image_id, *kf);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = entries_.find(image_id);
+    if (it == entries_.end()) {
+      // Removed while it was written
+      if (written) {
+        std::remove(filename(image_id).c_str());
+      }
+      continue;
+    }
+
+    Entry& entry = it->second;
+    if (entry.spilling != kf && entry.kf != kf) {
+      // Replaced by a new keyframe with the same id, not written yet
+      if (written && !entry.on_disk && !entry.spilling) {
+        std::remove(filename(image_id).c_str());
+      }
+      continue;
+    }
+
+    if (written) {
+      entry.on_disk = true;
+      entry.spilling.reset();
+    } else if (entry.spilling == kf) {
+      // Keep it in memory if we cannot write it
+      entry.kf = kf;
+      entry.spilling.reset();
+      lru_.push_back(image_id);
+      entry.lru_it = std::prev(lru_.end());
+      mem_bytes_ += kf->bytes();
+      spills_--;
+    }
+  }
+}
+
+std::string KeyframeStore::filename(const unsigned image_id) const {
+  // The address of the store avoids collisions between several detectors
+  std::stringstream ss;
+  ss << spill_dir_ << "/kf_" << this << "_" << image_id << ".bin";
+  return ss.str();
+}
+
+bool KeyframeStore::writeKeyframe(const unsigned image_id,
+                                  const Keyframe& kf) {
+  // Written to a temporary file first, so that a thread reloading the
+  // keyframe never reads it half written
+  std::stringstream tmp;
+  tmp << filename(image_id) << ".tmp" << tmp_files_++;
+  std::ofstream out(tmp.str(), std::ios::binary);
+  if (!out.is_open()) {
+    return false;
+  }
+
+  // Header
+  int header[4] = {static_cast<int>(kf.pts.size()),
+                   kf.descs.rows,
+                   kf.descs.cols,
+                   kf.descs.type()};
+  out.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+  // Keypoint positions
+  out.write(reinterpret_cast<const char*>(kf.pts.data()),
+            kf.pts.size() * sizeof(cv::Point2f));
+
+  // Descriptors, row by row since the matrix could be non-continuous
+  size_t row_bytes = kf.descs.cols * kf.descs.elemSize();
+  for (int i = 0; i < kf.descs.rows; i++) {
+    out.write(reinterpret_cast<const char*>(kf.descs.ptr(i)), row_bytes);
+  }
+  out.close();
+
+  boost::system::error_code ec;
+  if (out.good()) {
+    boost::filesystem::rename(tmp.str(), filename(image_id), ec);
+  }
+  if (!out.good() || ec) {
+    std::remove(tmp.str().c_str());
+    return false;
+  }
+
+  return true;
+}
+
+std::shared_ptr<const Keyframe> KeyframeStore::readKeyframe(
+                                            const unsigned image_id) const {
+  std::ifstream in(filename(image_id), std::ios::binary);
+  if (!in.is_open()) {
+    return std::shared_ptr<const Keyframe>();
+  }
+
+  int header[4];
+  in.read(reinterpret_cast<char*>(header), sizeof(header));
+  if (!in.good() || header[0] < 0 || header[1] < 0 || header[2] < 0) {
+    return std::shared_ptr<const Keyframe>();
+  }
+
+  std::shared_ptr<Keyframe> kf = std::make_shared<Keyframe>();
+  kf->pts.resize(header[0]);
+  in.read(reinterpret_cast<char*>(kf->pts.data()),
+          kf->pts.size() * sizeof(cv::Point2f));
+  kf->descs.create(header[1], header[2], header[3]);
+  in.read(reinterpret_cast<char*>(kf->descs.data),
+          kf->descs.total() * kf->descs.elemSize());
+
+  if (!in.good()) {
+    return std::shared_ptr<const Keyframe>();
+  }
+
+  return kf;
+}
+
+}  // namespace ibow_lcd
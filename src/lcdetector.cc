@@ -18,18 +18,197 @@
 */
 
 #include "ibow-lcd/lcdetector.h"
+#include "ibow-lcd/mapped_file.h"
+#include "ibow-lcd/result_sink.h"
 
 namespace ibow_lcd {
 
+namespace {
+
+// Snapshot format
+const char kSnapshotMagic[8] = {'I', 'B', 'O', 'W', 'L', 'C', 'D', '\0'};
+const uint32_t kSnapshotVersion = 4;
+
+// Params that shape the index, the keyframes and the journal of a snapshot.
+// A snapshot is only loaded by a detector created with the same ones.
+struct SnapshotParams {
+  uint32_t k;
+  uint32_t s;
+  uint32_t t;
+  uint32_t merge_policy;
+  uint32_t purge_descriptors;
+  uint32_t min_feat_apps;
+  uint32_t p;
+  float nndr;
+  uint32_t reuse_query_search;
+  float redundancy_ratio;
+  uint32_t forget_policy;
+  uint32_t max_indexed_images;
+  uint32_t forget_step;
+};
+
+SnapshotParams snapshotParams(const LCDetectorParams& params,
+                              const bool reuse_query_search) {
+  SnapshotParams sparams;
+  std::memset(&sparams, 0, sizeof(sparams));
+  sparams.k = params.k;
+  sparams.s = params.s;
+  sparams.t = params.t;
+  sparams.merge_policy = static_cast<uint32_t>(params.merge_policy);
+  sparams.purge_descriptors = params.purge_descriptors;
+  sparams.min_feat_apps = params.min_feat_apps;
+  sparams.p = params.p;
+  sparams.nndr = params.nndr;
+  sparams.reuse_query_search = reuse_query_search;
+  sparams.redundancy_ratio = params.redundancy_ratio;
+  sparams.forget_policy = static_cast<uint32_t>(params.forget_policy);
+  sparams.max_indexed_images = params.max_indexed_images;
+  sparams.forget_step = params.forget_step;
+  return sparams;
+}
+
+// Images indexed during a rebuild that are handed over together to insert
+// them into the new index in the background
+const unsigned kCatchUpChunk = 16;
+
+// Bounds of the search radius of guided matching (px)
+const float kMinGuidedRadius = 1.0f;
+const float kMaxGuidedRadius = 1000.0f;
+
+// The given frame if any, or a new one holding a copy of the keypoints. The
+// descriptors are never copied, cv::Mat is reference counted.
+FeatureFramePtr shareFrame(const unsigned image_id,
+                           const std::vector<cv::KeyPoint>& kps,
+                           const cv::Mat& descs,
+                           const FeatureFramePtr& frame) {
+  if (frame) {
+    return frame;
+  }
+
+  std::shared_ptr<FeatureFrame> copy = std::make_shared<FeatureFrame>();
+  copy->image_id = image_id;
+  copy->kps = kps;
+  copy->descs = descs;
+  return copy;
+}
+
+// obindex2 returns the position of the images in the index, which is replaced
+// by their id
+void toImageIds(const std::vector<unsigned>& image_ids,
+                std::vector<obindex2::ImageMatch>* image_matches) {
+  for (unsigned i = 0; i < image_matches->size(); i++) {
+    obindex2::ImageMatch& match = (*image_matches)[i];
+    match.image_id = static_cast<int>(image_ids[match.image_id]);
+  }
+}
+
+void toImageIds(const std::vector<unsigned>& image_ids,
+                PointMatchesMap* point_matches) {
+  PointMatchesMap by_position;
+  by_position.swap(*point_matches);
+  for (auto it = by_position.begin(); it != by_position.end(); it++) {
+    std::swap((*point_matches)[image_ids[it->first]], it->second);
+  }
+}
+
+template <typename T>
+void writeValue(std::ofstream& out, const T& value) {
+  out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// Keeps the sections aligned to 8 bytes, so they can be used once mapped
+void writePadding(std::ofstream& out) {
+  static const char zeros[8] = {0};
+  std::streamoff pos = out.tellp();
+  if (pos % 8) {
+    out.write(zeros, 8 - pos % 8);
+  }
+}
+
+// Sequential reader over a mapped snapshot with bounds checking
+class SnapshotReader {
+ public:
+  SnapshotReader(const char* data, const size_t size) :
+      data_(data),
+      size_(size),
+      pos_(0) {}
+
+  const char* take(const size_t bytes) {
+    if (bytes > size_ - pos_) {
+      return nullptr;
+    }
+    const char* ptr = data_ + pos_;
+    pos_ += bytes;
+    return ptr;
+  }
+
+  template <typename T>
+  bool read(T* value) {
+    const char* ptr = take(sizeof(T));
+    if (!ptr) {
+      return false;
+    }
+    memcpy(value, ptr, sizeof(T));
+    return true;
+  }
+
+  void skipPadding() {
+    pos_ = std::min(size_, (pos_ + 7) & ~static_cast<size_t>(7));
+  }
+
+ private:
+  const char* data_;
+  size_t size_;
+  size_t pos_;
+};
+
+}  // namespace
+
 LCDetector::LCDetector(const LCDetectorParams& params) :
+      LCDetector(params, std::shared_ptr<SharedIndex>()) {}
+
+LCDetector::LCDetector(const LCDetectorParams& params,
+                       const std::shared_ptr<SharedIndex>& shared) :
       last_lc_island_(-1, 0.0, -1, -1) {
-  // Creating the image index
-  index_ = std::make_shared<obindex2::ImageIndex>(params.k,
-                                                  params.s,
-                                                  params.t,
-                                                  params.merge_policy,
-                                                  params.purge_descriptors,
-                                                  params.min_feat_apps);
+  // Creating the image index and the keyframe store, unless they are shared
+  // with other sessions
+  multi_session_ = static_cast<bool>(shared);
+  shared_ = multi_session_ ? shared : std::make_shared<SharedIndex>(params);
+  if (params.session_id > kMaxSessionId) {
+    throw std::invalid_argument("LCDetector: session_id out of range");
+  }
+  session_id_ = params.session_id;
+  index_ = shared_->index;
+  kf_store_ = shared_->kf_store;
+  // Creating the geometric verifier
+  VerifierParams vparams;
+  vparams.type = params.verifier;
+  vparams.ep_dist = params.ep_dist;
+  vparams.conf_prob = params.conf_prob;
+  vparams.focal_length = params.focal_length;
+  vparams.pp = cv::Point2d(params.pp_x, params.pp_y);
+  if (params.early_exit_verification) {
+    vparams.min_inliers = params.min_inliers;
+  }
+  verifier_ = createVerifier(vparams);
+  early_exit_verification_ = params.early_exit_verification;
+  collect_stats_ = params.collect_stats;
+  curr_stats_ = nullptr;
+  sink_ = nullptr;
+  index_params_ = params;
+  // Images of the other sessions cannot be forgotten by this one
+  forget_policy_ = multi_session_ ? FORGET_NONE : params.forget_policy;
+  max_indexed_images_ = params.max_indexed_images;
+  forget_step_ = params.forget_step;
+  if (forget_policy_ != FORGET_NONE && max_indexed_images_) {
+    rebuilder_.reset(new WorkerThread());
+  }
+  rebuilding_ = false;
+  in_batch_ = false;
+  rebuild_start_ = 0;
+  rebuild_from_ = 0;
+  redundancy_ratio_ = params.redundancy_ratio;
+  snapshots_ = params.snapshots;
   // Storing the remaining parameters
   p_ = params.p;
   nndr_ = params.nndr;
@@ -41,68 +220,307 @@ LCDetector::LCDetector(const LCDetectorParams& params) :
   island_offset_ = island_size_ / 2;
   min_inliers_ = params.min_inliers;
   nframes_after_lc_ = params.nframes_after_lc;
+  // Other sessions could modify the index between the search of an image
+  // and its insertion, so it has to be matched again
+  reuse_query_search_ = params.reuse_query_search && !multi_session_;
+  batch_size_ = params.batch_size ? params.batch_size : 1;
+  max_verified_islands_ = params.max_verified_islands;
+  bf_matcher_ = params.bf_matcher;
+  // The radius is also the RANSAC threshold of the prediction
+  guided_matching_ = params.guided_matching &&
+                     std::isfinite(params.guided_radius);
+  guided_radius_ = std::min(std::max(params.guided_radius, kMinGuidedRadius),
+                            kMaxGuidedRadius);
+  if (params.async_insertion) {
+    inserter_.reset(new WorkerThread());
+  }
+  insert_id_ = 0;
   last_lc_result_.status = LC_NOT_DETECTED;
   min_consecutive_loops_ = params.min_consecutive_loops;
   consecutive_loops_ = 0;
 }
 
-LCDetector::~LCDetector() {}
+LCDetector::~LCDetector() {
+  // Finishing the pending insertions before releasing the index
+  rebuilder_.reset();
+  inserter_.reset();
+}
 
 void LCDetector::process(const unsigned image_id,
                          const std::vector<cv::KeyPoint>& kps,
                          const cv::Mat& descs,
                          LCDetectorResult* result) {
-  result->query_id = image_id;
+  processFrame(globalId(image_id), kps, descs,
+               FeatureFramePtr(), result);
+}
+
+void LCDetector::process(const FeatureFramePtr& frame,
+                         LCDetectorResult* result) {
+  processFrame(globalId(frame->image_id), frame->kps,
+               frame->descs, frame, result);
+}
+
+void LCDetector::process(FeatureFrame&& frame, LCDetectorResult* result) {
+  process(FeatureFramePtr(std::make_shared<FeatureFrame>(std::move(frame))),
+          result);
+}
+
+void LCDetector::processFrame(const unsigned image_id,
+                              const std::vector<cv::KeyPoint>& kps,
+                              const cv::Mat& descs,
+                              const FeatureFramePtr& frame,
+                              LCDetectorResult* result) {
+  auto start = std::chrono::steady_clock::now();
 
   // Storing the keypoints and descriptors
-  prev_kps_.push_back(kps);
-  prev_descs_.push_back(descs);
+  std::shared_ptr<const Keyframe> query = kf_store_->add(image_id, kps, descs);
 
-  // Adding the current image to the queue to be added in the future
-  queue_ids_.push(image_id);
+  // Searching similar images in the index
+  searchImage(image_id, kps, descs, frame, &search_res_);
 
-  // Assessing if, at least, p images have arrived
-  if (queue_ids_.size() < p_) {
-    result->status = LC_NOT_ENOUGH_IMAGES;
-    result->train_id = 0;
-    result->inliers = 0;
-    last_lc_result_.status = LC_NOT_ENOUGH_IMAGES;
-    return;
+  LCDetectorTrace trace;
+  assessSearch(image_id, *query, search_res_, &trace, result);
+
+  if (sink_) {
+    auto end = std::chrono::steady_clock::now();
+    trace.time = std::chrono::duration<double, std::milli>(end - start).count();
+    traceAssumed(*query, search_res_, &trace);
+    writeResult(*result, &trace);
   }
+}
 
-  // Adding new hypothesis
-  unsigned newimg_id = queue_ids_.front();
-  queue_ids_.pop();
+unsigned LCDetector::globalId(const unsigned image_id) const {
+  // Local ids cannot use the bits of the session
+  unsigned session = imageSession(image_id);
+  if (session != 0 && session != session_id_) {
+    throw std::out_of_range("LCDetector: image id out of range");
+  }
+  return sessionImageId(session_id_, image_id);
+}
 
-  addImage(newimg_id, prev_kps_[newimg_id], prev_descs_[newimg_id]);
+LCDetectorStats* LCDetector::newStats(const unsigned image_id) {
+  if (!collect_stats_) {
+    return nullptr;
+  }
 
-  // Searching similar images in the index
-  // Matching the descriptors agains the current visual words
-  std::vector<std::vector<cv::DMatch> > matches_feats;
+  stats_.push_back(LCDetectorStats());
+  stats_.back().image_id = image_id;
+  return &stats_.back();
+}
 
-  // Searching the query descriptors against the features
-  index_->searchDescriptors(descs, &matches_feats, 2, 64);
+void LCDetector::search(const unsigned image_id,
+                        const std::vector<cv::KeyPoint>& kps,
+                        const cv::Mat& descs,
+                        LCDetectorSearch* search_res) {
+  unsigned query_id = globalId(image_id);
 
-  // Filtering matches according to the ratio test
-  std::vector<cv::DMatch> matches;
-  filterMatches(matches_feats, &matches);
+  // Forgetting rebuilds the index from the keyframes
+  if (rebuilder_) {
+    kf_store_->add(query_id, kps, descs);
+  }
 
-  std::vector<obindex2::ImageMatch> image_matches;
+  searchImage(query_id, kps, descs, FeatureFramePtr(), search_res);
+}
 
-  // We look for similar images according to the filtered matches found
-  index_->searchImages(descs, matches, &image_matches, true);
+void LCDetector::searchImage(const unsigned image_id,
+                             const std::vector<cv::KeyPoint>& kps,
+                             const cv::Mat& descs,
+                             const FeatureFramePtr& frame,
+                             LCDetectorSearch* search_res) {
+  search_res->stats = LCDetectorStats();
+  search_res->stats.image_id = image_id;
+  curr_stats_ = collect_stats_ ? &search_res->stats : nullptr;
+  {
+    StageTimer timer(curr_stats_, STAGE_TOTAL);
+    search_res->enough_images = searchCandidates(image_id, kps, descs, frame,
+                                                 &search_res->image_matches,
+                                                 &search_res->point_matches,
+                                                 &search_res->represented);
+  }
+  curr_stats_ = nullptr;
+  search_res->stats.candidates = search_res->image_matches.size();
+}
 
-  // Filtering the resulting image matchings
-  std::vector<obindex2::ImageMatch> image_matches_filt;
-  filterCandidates(image_matches, &image_matches_filt);
+void LCDetector::replay(const unsigned image_id,
+                        const std::vector<cv::KeyPoint>& kps,
+                        const cv::Mat& descs,
+                        const LCDetectorSearch& search_res,
+                        LCDetectorResult* result) {
+  auto start = std::chrono::steady_clock::now();
+  unsigned query_id = globalId(image_id);
+
+  // Storing the keypoints and descriptors
+  std::shared_ptr<const Keyframe> query = kf_store_->add(query_id, kps, descs);
+
+  LCDetectorTrace trace;
+  assessSearch(query_id, *query, search_res, &trace, result);
+
+  if (sink_) {
+    auto end = std::chrono::steady_clock::now();
+    trace.time = std::chrono::duration<double, std::milli>(end - start).count();
+    traceAssumed(*query, search_res, &trace);
+    writeResult(*result, &trace);
+  }
+}
+
+void LCDetector::query(const std::vector<cv::KeyPoint>& kps,
+                       const cv::Mat& descs,
+                       LCDetectorResult* result) {
+  result->query_id = 0;
+  result->train_id = 0;
+  result->train_session = 0;
+  result->inliers = 0;
+  result->cand_ids.clear();
+  result->cand_inliers.clear();
+
+  // Searching the index. Only the buffers of this call are used, since the
+  // detector ones belong to the thread processing the sequence. The index
+  // is searched by a single thread at a time, and the candidates are
+  // verified in parallel with the other calls.
+  std::vector<obindex2::ImageMatch> image_matches;
+  PointMatchesMap point_matches;
+  std::map<unsigned, unsigned> represented;
+  {
+    IndexLock lock(shared_->mutex);
+    if (index_->numImages() == 0) {
+      result->status = LC_NOT_ENOUGH_IMAGES;
+      return;
+    }
+
+    std::vector<std::vector<cv::DMatch> > matches_feats;
+    std::vector<cv::DMatch> matches;
+    index_->searchDescriptors(descs, &matches_feats, 2, 64);
+    filterMatches(matches_feats, &matches);
+    index_->searchImages(descs, matches, &image_matches, true);
+    toImageIds(shared_->image_ids, &image_matches);
+    if (guided_matching_) {
+      index_->getMatchings(kps, matches, &point_matches);
+      toImageIds(shared_->image_ids, &point_matches);
+    }
+    copyRepresented(image_matches, &represented);
+  }
 
+  ImageBuffers bufs;
   std::vector<Island> islands;
-  buildIslands(image_matches_filt, &islands);
+  getIslands(image_matches, represented, &bufs, &islands, nullptr);
+  if (!islands.size()) {
+    result->status = LC_NOT_ENOUGH_ISLANDS;
+    return;
+  }
+
+  // There is no previous loop to prefer an island, so the best ones are
+  // verified in order of score. They are verified serially, since queries
+  // already run in parallel with each other and with the processing, and
+  // with their own buffers.
+  Keyframe query;
+  query.pts.reserve(kps.size());
+  for (unsigned i = 0; i < kps.size(); i++) {
+    query.pts.push_back(kps[i].pt);
+  }
+  query.descs = descs;
+  unsigned ncands = std::min<size_t>(islands.size(),
+                                     std::max(max_verified_islands_, 1u));
+  unsigned best = 0;
+  unsigned best_inliers = 0;
+  result->status = LC_NOT_ENOUGH_INLIERS;
+  for (unsigned i = 0; i < ncands; i++) {
+    unsigned inliers = verifyLoop(query, islands[i].img_id, point_matches,
+                                  &bufs, nullptr);
+    if (ncands > 1) {
+      result->cand_ids.push_back(islands[i].img_id);
+      result->cand_inliers.push_back(inliers);
+    }
+    if (i == 0) {
+      best_inliers = inliers;
+    }
+
+    if (inliers > min_inliers_) {
+      best = i;
+      best_inliers = inliers;
+      result->status = LC_DETECTED;
+      break;
+    }
+  }
+
+  result->train_id = islands[best].img_id;
+  result->train_session = imageSession(result->train_id);
+  result->inliers = best_inliers;
+}
+
+void LCDetector::traceAssumed(const Keyframe& query,
+                              const LCDetectorSearch& search_res,
+                              LCDetectorTrace* trace) {
+  // Assumed loops are verified anyway, out of the time of the image, since
+  // they could not be assumed for other thresholds when the trace is replayed
+  if (trace->assumed) {
+    trace->inliers = verifyLoop(query, trace->img_id, search_res.point_matches,
+                                imageBuffers(1), nullptr);
+  }
+}
+
+void LCDetector::writeResult(const LCDetectorResult& result,
+                             LCDetectorTrace* trace) {
+  // The index is neither waited for nor locked. In asynchronous mode, the
+  // vocabulary may not include the image being inserted yet.
+  trace->vocabulary_size = shared_->num_descriptors.load();
+  sink_->write(result, *trace);
+}
+
+void LCDetector::assessSearch(const unsigned image_id,
+                              const Keyframe& query,
+                              const LCDetectorSearch& search_res,
+                              LCDetectorTrace* trace,
+                              LCDetectorResult* result) {
+  // The stats of the image start from the ones of its search
+  LCDetectorStats* stats = newStats(image_id);
+  if (stats) {
+    *stats = search_res.stats;
+    stats->image_id = image_id;
+  }
+
+  {
+    StageTimer timer(stats, STAGE_TOTAL);
+    assessCandidates(image_id, query, search_res, stats, trace, result);
+  }
+
+  if (stats) {
+    stats->inliers = result->inliers;
+  }
+}
+
+void LCDetector::assessCandidates(const unsigned image_id,
+                                  const Keyframe& query,
+                                  const LCDetectorSearch& search_res,
+                                  LCDetectorStats* stats,
+                                  LCDetectorTrace* trace,
+                                  LCDetectorResult* result) {
+  result->query_id = image_id;
+  result->cand_ids.clear();
+  result->cand_inliers.clear();
+
+  const std::vector<obindex2::ImageMatch>& image_matches =
+                                                  search_res.image_matches;
+  const PointMatchesMap& point_matches = search_res.point_matches;
+  if (!search_res.enough_images) {
+    // Not enough images yet
+    result->status = LC_NOT_ENOUGH_IMAGES;
+    result->train_id = 0;
+    result->train_session = 0;
+    result->inliers = 0;
+    last_lc_result_.status = LC_NOT_ENOUGH_IMAGES;
+    return;
+  }
+
+  // Filtering the resulting image matchings and building the islands
+  std::vector<Island>& islands = islands_;
+  getIslands(image_matches, search_res.represented, imageBuffers(1), &islands,
+             stats);
 
   if (!islands.size()) {
     // No resulting islands
     result->status = LC_NOT_ENOUGH_ISLANDS;
     result->train_id = 0;
+    result->train_session = 0;
     result->inliers = 0;
     last_lc_result_.status = LC_NOT_ENOUGH_ISLANDS;
     return;
@@ -114,196 +532,952 @@ void LCDetector::process(const unsigned image_id,
   // }
 
   // Selecting the corresponding island to be processed
-  Island island = islands[0];
-  std::vector<Island> p_islands;
-  getPriorIslands(last_lc_island_, islands, &p_islands);
-  if (p_islands.size()) {
-    island = p_islands[0];
-  }
-
-  bool overlap = island.overlaps(last_lc_island_);
-  last_lc_island_ = island;
-
-  // if () {
-  //   consecutive_loops_++;
-  // } else {
-  //   consecutive_loops_ = 1;
-  // }
-
+  bool overlap;
+  Island island = selectIsland(islands, &overlap);
   unsigned best_img = island.img_id;
+  trace->min_id = island.min_img_id;
+  trace->max_id = island.max_img_id;
+  trace->img_id = best_img;
+  trace->overlap = overlap;
 
   // Assessing the loop
   if (consecutive_loops_ > min_consecutive_loops_ && overlap) {
     // LOOP can be considered as detected
-    result->status = LC_DETECTED;
-    result->train_id = best_img;
-    result->inliers = 0;
-    // Store the last result
-    last_lc_result_ = *result;
-    consecutive_loops_++;
-  } else {
-    // We obtain the image matchings, since we need them for compute F
-    std::vector<cv::DMatch> tmatches;
-    std::vector<cv::Point2f> tquery;
-    std::vector<cv::Point2f> ttrain;
-    ratioMatchingBF(descs, prev_descs_[best_img], &tmatches);
-    convertPoints(kps, prev_kps_[best_img], tmatches, &tquery, &ttrain);
-    unsigned inliers = checkEpipolarGeometry(tquery, ttrain);
+    trace->assumed = true;
+    assessLoop(best_img, true, 0, result);
+  } else if (max_verified_islands_ > 1) {
+    // The best islands are verified, starting by the selected one
+    std::vector<Island>& candidates = candidates_;
+    candidates.clear();
+    candidates.push_back(island);
+    for (unsigned i = 0; i < islands.size() &&
+                         candidates.size() < max_verified_islands_; i++) {
+      if (islands[i].img_id != island.img_id) {
+        candidates.push_back(islands[i]);
+      }
+    }
 
-    if (inliers > min_inliers_) {
-      // LOOP detected
-      result->status = LC_DETECTED;
-      result->train_id = best_img;
-      result->inliers = inliers;
-      // Store the last result
-      last_lc_result_ = *result;
-      consecutive_loops_++;
+    std::vector<unsigned>& inliers = cand_inliers_;
+    int accepted = verifyIslands(query, candidates, point_matches,
+                                 &inliers, stats);
+    for (unsigned i = 0; i < inliers.size(); i++) {
+      result->cand_ids.push_back(candidates[i].img_id);
+      result->cand_inliers.push_back(inliers[i]);
+    }
+
+    if (accepted > 0) {
+      // Another island has been accepted instead of the selected one
+      last_lc_island_ = candidates[accepted];
+      trace->min_id = candidates[accepted].min_img_id;
+      trace->max_id = candidates[accepted].max_img_id;
+      trace->img_id = candidates[accepted].img_id;
     } else {
-      result->status = LC_NOT_ENOUGH_INLIERS;
-      result->train_id = best_img;
-      result->inliers = inliers;
-      last_lc_result_.status = LC_NOT_ENOUGH_INLIERS;
-      consecutive_loops_ = 0;
+      accepted = 0;
     }
+    trace->inliers = inliers[accepted];
+    assessLoop(candidates[accepted].img_id, false, inliers[accepted], result);
+  } else {
+    unsigned inliers = verifyLoop(query, best_img, point_matches,
+                                  imageBuffers(1), stats);
+    trace->inliers = inliers;
+    assessLoop(best_img, false, inliers, result);
   }
-  // else {
-  //   result->status = LC_NOT_DETECTED;
-  //   last_lc_result_.status = LC_NOT_DETECTED;
-  // }
 }
 
-void LCDetector::debug(const unsigned image_id,
-             const std::vector<cv::KeyPoint>& kps,
-             const cv::Mat& descs,
-             std::ofstream& out_file) {
-  auto start = std::chrono::steady_clock::now();
-  // Storing the keypoints and descriptors
-  prev_kps_.push_back(kps);
-  prev_descs_.push_back(descs);
+void LCDetector::processBatch(
+      const std::vector<unsigned>& image_ids,
+      const std::vector<std::vector<cv::KeyPoint> >& kps,
+      const std::vector<cv::Mat>& descs,
+      std::vector<LCDetectorResult>* results) {
+  unsigned nimages = image_ids.size();
+  results->clear();
+  results->resize(nimages);
+
+  // Namespacing the ids with the session
+  std::vector<unsigned> ids(nimages);
+  for (unsigned i = 0; i < nimages; i++) {
+    ids[i] = globalId(image_ids[i]);
+  }
+
+  // The island accepted for an image conditions the island selected for
+  // the next one, so the images cannot be assessed in advance. Neither can
+  // they be searched in advance when the index forgets images or the store
+  // drops keyframes, since both depend on the images already processed.
+  bool drops_keyframes = index_params_.kf_budget &&
+                         index_params_.kf_spill_dir.empty();
+  if (max_verified_islands_ > 1 || rebuilder_ || drops_keyframes) {
+    for (unsigned i = 0; i < nimages; i++) {
+      process(image_ids[i], kps[i], descs[i], &results->at(i));
+    }
+    return;
+  }
+
+  for (unsigned start = 0; start < nimages; start += batch_size_) {
+    int n = static_cast<int>(std::min(batch_size_, nimages - start));
+    auto batch_start = std::chrono::steady_clock::now();
+
+    // Stats of the images of this batch
+    std::vector<LCDetectorStats*> stats(n, nullptr);
+    if (collect_stats_) {
+      size_t first = stats_.size();
+      stats_.resize(first + n);
+      for (int i = 0; i < n; i++) {
+        stats[i] = &stats_[first + i];
+        stats[i]->image_id = ids[start + i];
+      }
+    }
+
+    // The index has to be searched and updated in order. The candidates
+    // found are kept even if the index forgets them meanwhile.
+    in_batch_ = true;
+    std::vector<std::vector<obindex2::ImageMatch> > image_matches(n);
+    std::vector<PointMatchesMap> point_matches(n);
+    std::vector<std::map<unsigned, unsigned> > represented(n);
+    std::vector<char> enough_images(n, 0);
+    std::vector<std::shared_ptr<const Keyframe> > queries(n);
+    for (int i = 0; i < n; i++) {
+      unsigned j = start + i;
+      results->at(j).query_id = ids[j];
+      queries[i] = kf_store_->add(ids[j], kps[j], descs[j]);
+      curr_stats_ = stats[i];
+      enough_images[i] = searchCandidates(ids[j], kps[j], descs[j],
+                                          FeatureFramePtr(),
+                                          &image_matches[i],
+                                          &point_matches[i],
+                                          &represented[i]);
+      curr_stats_ = nullptr;
+      if (stats[i]) {
+        stats[i]->candidates = image_matches[i].size();
+      }
+    }
+
+    // Islands only depend on the candidates of each image, and on the images
+    // they represented when it was searched
+    std::vector<std::vector<Island> > islands(n);
+    ImageBuffers* bufs = imageBuffers(n);
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < n; i++) {
+      if (enough_images[i]) {
+        getIslands(image_matches[i], represented[i], &bufs[i], &islands[i],
+                   stats[i]);
+      }
+    }
+
+    // The selected island depends on the one of the previous image
+    std::vector<Island> selected(n, Island(0, 0.0, 0, 0));
+    std::vector<unsigned> best_imgs(n, 0);
+    std::vector<char> overlaps(n, 0);
+    for (int i = 0; i < n; i++) {
+      if (islands[i].size()) {
+        bool overlap;
+        selected[i] = selectIsland(islands[i], &overlap);
+        best_imgs[i] = selected[i].img_id;
+        overlaps[i] = overlap;
+      }
+    }
+
+    // Only the candidates overlapping the previous island can be assumed,
+    // so the rest are verified in advance. Whether the others are assumed is
+    // not known until the previous images are assessed.
+    std::vector<unsigned> inliers(n, 0);
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < n; i++) {
+      if (islands[i].size() && !overlaps[i]) {
+        inliers[i] = verifyLoop(*queries[i], best_imgs[i], point_matches[i],
+                                &bufs[i], stats[i]);
+      }
+    }
+
+    // Assessing the loops in order
+    std::vector<LCDetectorTrace> traces(n);
+    for (int i = 0; i < n; i++) {
+      LCDetectorResult* result = &results->at(start + i);
+      if (islands[i].size()) {
+        traces[i].min_id = selected[i].min_img_id;
+        traces[i].max_id = selected[i].max_img_id;
+        traces[i].img_id = best_imgs[i];
+        traces[i].overlap = overlaps[i];
+      }
+
+      if (!enough_images[i]) {
+        result->status = LC_NOT_ENOUGH_IMAGES;
+        result->train_id = 0;
+        result->train_session = 0;
+        result->inliers = 0;
+        last_lc_result_.status = LC_NOT_ENOUGH_IMAGES;
+      } else if (!islands[i].size()) {
+        result->status = LC_NOT_ENOUGH_ISLANDS;
+        result->train_id = 0;
+        result->train_session = 0;
+        result->inliers = 0;
+        last_lc_result_.status = LC_NOT_ENOUGH_ISLANDS;
+      } else if (consecutive_loops_ > min_consecutive_loops_ && overlaps[i]) {
+        traces[i].assumed = true;
+        assessLoop(best_imgs[i], true, 0, result);
+      } else {
+        if (overlaps[i]) {
+          inliers[i] = verifyLoop(*queries[i], best_imgs[i], point_matches[i],
+                                  &bufs[i], stats[i]);
+        }
+        traces[i].inliers = inliers[i];
+        assessLoop(best_imgs[i], false, inliers[i], result);
+      }
+
+      // The stages of the batch are interleaved, so only their times add up
+      if (stats[i]) {
+        stats[i]->inliers = result->inliers;
+        for (unsigned s = 0; s < STAGE_TOTAL; s++) {
+          stats[i]->time[STAGE_TOTAL] += stats[i]->time[s];
+        }
+      }
+    }
+
+    // The images of a batch are processed together, so they share its time
+    if (sink_) {
+      auto batch_end = std::chrono::steady_clock::now();
+      double time = std::chrono::duration<double, std::milli>(
+                                          batch_end - batch_start).count() / n;
+
+      // Assumed loops are verified out of the time of the batch, as in
+      // process()
+      #pragma omp parallel for schedule(dynamic)
+      for (int i = 0; i < n; i++) {
+        if (traces[i].assumed) {
+          traces[i].inliers = verifyLoop(*queries[i], best_imgs[i],
+                                         point_matches[i], &bufs[i], nullptr);
+        }
+      }
+
+      for (int i = 0; i < n; i++) {
+        traces[i].time = time;
+        writeResult(results->at(start + i), &traces[i]);
+      }
+    }
+
+    in_batch_ = false;
+    dropForgotten();
+  }
+}
+
+bool LCDetector::save(const std::string& filename) {
+  // A shared index does not belong to a single session, and the index can
+  // only be restored from the journal
+  if (multi_session_ || !snapshots_) {
+    return false;
+  }
+
+  // The index should not be modified while it is saved
+  waitInsertions();
+
+  // The snapshot is written aside, so that an existing one is only replaced
+  // by a complete snapshot
+  std::string tmp_filename = filename + ".tmp";
+  bool saved;
+  {
+    std::ofstream out(tmp_filename, std::ios::binary);
+    saved = out.is_open() && writeSnapshot(out);
+    out.close();
+    saved = saved && !out.fail();
+  }
+  if (!saved || std::rename(tmp_filename.c_str(), filename.c_str())) {
+    std::remove(tmp_filename.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool LCDetector::writeSnapshot(std::ofstream& out) {
+  // The images still to be inserted are restored from their keyframes
+  std::vector<unsigned> queue;
+  std::queue<unsigned> tqueue = queue_ids_;
+  while (!tqueue.empty()) {
+    queue.push_back(tqueue.front());
+    tqueue.pop();
+  }
+
+  // Header
+  out.write(kSnapshotMagic, sizeof(kSnapshotMagic));
+  writeValue(out, kSnapshotVersion);
+  writeValue(out, snapshotParams(index_params_, reuse_query_search_));
+
+  // Detector state
+  writeValue(out, static_cast<int32_t>(consecutive_loops_));
+  writeValue(out, static_cast<uint32_t>(last_lc_result_.status));
+  writeValue(out, static_cast<uint32_t>(last_lc_result_.query_id));
+  writeValue(out, static_cast<uint32_t>(last_lc_result_.train_id));
+  writeValue(out, static_cast<uint32_t>(last_lc_result_.inliers));
+  writeValue(out, static_cast<uint32_t>(last_lc_island_.img_id));
+  writeValue(out, static_cast<uint32_t>(last_lc_island_.min_img_id));
+  writeValue(out, static_cast<uint32_t>(last_lc_island_.max_img_id));
+  writePadding(out);
+  writeValue(out, last_lc_island_.score);
+
+  // Keyframes
+  std::vector<unsigned> kf_ids = kf_store_->keyframeIds();
+  writeValue(out, static_cast<uint64_t>(kf_ids.size()));
+  for (unsigned i = 0; i < kf_ids.size(); i++) {
+    std::shared_ptr<const Keyframe> kf = kf_store_->get(kf_ids[i]);
+    if (!kf) {
+      return false;
+    }
+
+    writeValue(out, static_cast<uint32_t>(kf_ids[i]));
+    writeValue(out, static_cast<uint32_t>(kf->pts.size()));
+    writeValue(out, static_cast<int32_t>(kf->descs.rows));
+    writeValue(out, static_cast<int32_t>(kf->descs.cols));
+    writeValue(out, static_cast<int32_t>(kf->descs.type()));
+    out.write(reinterpret_cast<const char*>(kf->pts.data()),
+              kf->pts.size() * sizeof(cv::Point2f));
+    writePadding(out);
+    size_t row_bytes = kf->descs.cols * kf->descs.elemSize();
+    for (int r = 0; r < kf->descs.rows; r++) {
+      out.write(reinterpret_cast<const char*>(kf->descs.ptr(r)), row_bytes);
+    }
+    writePadding(out);
+  }
+
+  // Insertions into the index
+  writeValue(out, static_cast<uint64_t>(journal_.size()));
+  for (unsigned i = 0; i < journal_.size(); i++) {
+    const std::vector<cv::DMatch>& matches = journal_[i].matches;
+    writeValue(out, static_cast<uint32_t>(journal_[i].image_id));
+    writeValue(out, static_cast<uint32_t>(matches.size()));
+    for (unsigned m = 0; m < matches.size(); m++) {
+      writeValue(out, static_cast<int32_t>(matches[m].queryIdx));
+      writeValue(out, static_cast<int32_t>(matches[m].trainIdx));
+      writeValue(out, matches[m].distance);
+    }
+  }
+  writePadding(out);
+
+  // Queue of images pending to be published
+  writeValue(out, static_cast<uint64_t>(queue.size()));
+  for (unsigned i = 0; i < queue.size(); i++) {
+    writeValue(out, static_cast<uint32_t>(queue[i]));
+  }
+
+  // Images skipped by the keyframe selection
+  writeValue(out, static_cast<uint64_t>(represented_.size()));
+  for (auto it = represented_.begin(); it != represented_.end(); it++) {
+    writeValue(out, static_cast<uint32_t>(it->first));
+    writeValue(out, static_cast<uint32_t>(it->second));
+  }
+
+  return out.good();
+}
+
+bool LCDetector::load(const std::string& filename) {
+  if (multi_session_) {
+    return false;
+  }
+
+  waitInsertions();
+  IndexLock lock(shared_->mutex);
+  if (index_->numImages() > 0 || kf_store_->numKeyframes() > 0 ||
+      !queue_ids_.empty()) {
+    return false;
+  }
+
+  MappedFile snapshot;
+  if (!snapshot.open(filename)) {
+    return false;
+  }
+  SnapshotReader reader(snapshot.data(), snapshot.size());
+
+  // Header
+  const char* magic = reader.take(sizeof(kSnapshotMagic));
+  uint32_t version;
+  SnapshotParams sparams;
+  SnapshotParams expected = snapshotParams(index_params_,
+                                           reuse_query_search_);
+  if (!magic || memcmp(magic, kSnapshotMagic, sizeof(kSnapshotMagic)) ||
+      !reader.read(&version) || version != kSnapshotVersion ||
+      !reader.read(&sparams) ||
+      memcmp(&sparams, &expected, sizeof(sparams))) {
+    return false;
+  }
+
+  // Detector state
+  int32_t consecutive_loops;
+  uint32_t state[7];
+  double score;
+  if (!reader.read(&consecutive_loops) || !reader.read(&state)) {
+    return false;
+  }
+  reader.skipPadding();
+  if (!reader.read(&score)) {
+    return false;
+  }
+
+  // Keyframes. The store copies them, the snapshot is unmapped on return
+  uint64_t nkfs;
+  if (!reader.read(&nkfs)) {
+    return false;
+  }
+  for (uint64_t i = 0; i < nkfs; i++) {
+    uint32_t image_id, npts;
+    int32_t rows, cols, type;
+    if (!reader.read(&image_id) || !reader.read(&npts) ||
+        !reader.read(&rows) || !reader.read(&cols) || !reader.read(&type)) {
+      return false;
+    }
+
+    size_t descs_bytes = static_cast<size_t>(rows) * cols * CV_ELEM_SIZE(type);
+    const char* pts_data = reader.take(npts * sizeof(cv::Point2f));
+    reader.skipPadding();
+    const char* descs_data = reader.take(descs_bytes);
+    if (!pts_data || !descs_data ||
+        reinterpret_cast<uintptr_t>(descs_data) % 8) {
+      return false;
+    }
+    reader.skipPadding();
+
+    std::vector<cv::Point2f> pts(npts);
+    memcpy(pts.data(), pts_data, npts * sizeof(cv::Point2f));
+    cv::Mat descs(rows, cols, type, const_cast<char*>(descs_data));
+    kf_store_->add(image_id, pts, descs);
+  }
+
+  // Replaying the insertions rebuilds the index without searching it again
+  uint64_t ninsertions;
+  if (!reader.read(&ninsertions)) {
+    return false;
+  }
+  for (uint64_t i = 0; i < ninsertions; i++) {
+    uint32_t image_id, nmatches;
+    if (!reader.read(&image_id) || !reader.read(&nmatches)) {
+      return false;
+    }
+
+    std::vector<cv::DMatch> matches(nmatches);
+    for (uint32_t m = 0; m < nmatches; m++) {
+      int32_t query_idx, train_idx;
+      float distance;
+      if (!reader.read(&query_idx) || !reader.read(&train_idx) ||
+          !reader.read(&distance)) {
+        return false;
+      }
+      matches[m] = cv::DMatch(query_idx, train_idx, distance);
+    }
+
+    std::shared_ptr<const Keyframe> kf = kf_store_->get(image_id);
+    if (!kf) {
+      return false;
+    }
+    std::vector<cv::KeyPoint> kps;
+    cv::KeyPoint::convert(kf->pts, kps);
+    insertImage(image_id, kps, kf->descs, matches);
+  }
+  reader.skipPadding();
+
+  // Queue of images pending to be published
+  uint64_t nqueue;
+  if (!reader.read(&nqueue)) {
+    return false;
+  }
+  for (uint64_t i = 0; i < nqueue; i++) {
+    uint32_t image_id;
+    if (!reader.read(&image_id)) {
+      return false;
+    }
+    queue_ids_.push(image_id);
+
+    if (!reuse_query_search_) {
+      std::shared_ptr<const Keyframe> kf = kf_store_->get(image_id);
+      if (!kf) {
+        return false;
+      }
+      std::shared_ptr<FeatureFrame> frame = std::make_shared<FeatureFrame>();
+      frame->image_id = image_id;
+      cv::KeyPoint::convert(kf->pts, frame->kps);
+      frame->descs = kf->descs;
+      queue_frames_.push(frame);
+    }
+  }
+
+  // Images skipped by the keyframe selection
+  uint64_t nrepresented;
+  if (!reader.read(&nrepresented)) {
+    return false;
+  }
+  for (uint64_t i = 0; i < nrepresented; i++) {
+    uint32_t rep, last;
+    if (!reader.read(&rep) || !reader.read(&last)) {
+      return false;
+    }
+    represented_[rep] = last;
+  }
+
+  consecutive_loops_ = consecutive_loops;
+  last_lc_result_.status = static_cast<LCDetectorStatus>(state[0]);
+  last_lc_result_.query_id = state[1];
+  last_lc_result_.train_id = state[2];
+  last_lc_result_.inliers = state[3];
+  last_lc_island_ = Island(state[4], score, state[5], state[6]);
+
+  return true;
+}
+
+bool LCDetector::searchCandidates(
+      const unsigned image_id,
+      const std::vector<cv::KeyPoint>& kps,
+      const cv::Mat& descs,
+      const FeatureFramePtr& frame,
+      std::vector<obindex2::ImageMatch>* image_matches,
+      PointMatchesMap* point_matches,
+      std::map<unsigned, unsigned>* represented) {
+  image_matches->clear();
+  point_matches->clear();
+  represented->clear();
+
+  if (reuse_query_search_) {
+    return searchCandidatesOnce(image_id, kps, descs, frame, image_matches,
+                                point_matches, represented);
+  }
 
   // Adding the current image to the queue to be added in the future
   queue_ids_.push(image_id);
+  queue_frames_.push(shareFrame(image_id, kps, descs, frame));
 
   // Assessing if, at least, p images have arrived
   if (queue_ids_.size() < p_) {
-    auto end = std::chrono::steady_clock::now();
-    auto diff = end - start;
-    out_file << 0 << "\t";  // min_id
-    out_file << 0 << "\t";  // max_id
-    out_file << 0 << "\t";  // img_id
-    out_file << 0 << "\t";  // overlap
-    out_file << 0 << "\t";  // Inliers
-    out_file << index_->numDescriptors() << "\t";  // Voc. Size
-    out_file << std::chrono::duration<double, std::milli>(diff).count() << "\t";  // Time
-    out_file << std::endl;
-    return;
+    return false;
   }
 
-  // Adding new hypothesis
-  unsigned newimg_id = queue_ids_.front();
-  queue_ids_.pop();
+  // Adding new hypothesis. In asynchronous mode, it is inserted in the
+  // background once the current image has been searched
+  if (!inserter_) {
+    StageTimer timer(curr_stats_, STAGE_INSERT_IMAGE);
+    insertNextImage();
+  }
+
+  // The index should not be modified while it is searched
+  waitInsertions();
+  forgetImages();
+  IndexLock lock(shared_->mutex);
+  if (curr_stats_) {
+    curr_stats_->vocabulary_size = index_->numDescriptors();
+  }
 
-  addImage(newimg_id, prev_kps_[newimg_id], prev_descs_[newimg_id]);
+  // In asynchronous mode, the first query finds an empty index
+  if (index_->numImages() > 0) {
+    // Searching similar images in the index
+    // Matching the descriptors agains the current visual words
+    {
+      StageTimer timer(curr_stats_, STAGE_SEARCH_DESCRIPTORS);
 
-  // Searching similar images in the index
-  // Matching the descriptors agains the current visual words
-  std::vector<std::vector<cv::DMatch> > matches_feats;
+      // Searching the query descriptors against the features
+      query_feats_.clear();
+      index_->searchDescriptors(descs, &query_feats_, 2, 64);
 
-  // Searching the query descriptors against the features
-  index_->searchDescriptors(descs, &matches_feats, 2, 64);
+      // Filtering matches according to the ratio test
+      filterMatches(query_feats_, &query_matches_);
+    }
 
-  // Filtering matches according to the ratio test
-  std::vector<cv::DMatch> matches;
-  filterMatches(matches_feats, &matches);
+    // We look for similar images according to the filtered matches found
+    StageTimer timer(curr_stats_, STAGE_SEARCH_IMAGES);
+    index_->searchImages(descs, query_matches_, image_matches, true);
+    toImageIds(shared_->image_ids, image_matches);
 
-  std::vector<obindex2::ImageMatch> image_matches;
+    // Correspondences to guide the matching when verifying
+    if (guided_matching_) {
+      index_->getMatchings(kps, query_matches_, point_matches);
+      toImageIds(shared_->image_ids, point_matches);
+    }
+    copyRepresented(*image_matches, represented);
+  }
+  lock.unlock();
 
-  // We look for similar images according to the filtered matches found
-  index_->searchImages(descs, matches, &image_matches, true);
+  if (inserter_) {
+    insertNextImage();
+  }
 
-  // Filtering the resulting image matchings
-  std::vector<obindex2::ImageMatch> image_matches_filt;
-  filterCandidates(image_matches, &image_matches_filt);
+  return true;
+}
 
-  std::vector<Island> islands;
-  buildIslands(image_matches_filt, &islands);
+bool LCDetector::searchCandidatesOnce(
+      const unsigned image_id,
+      const std::vector<cv::KeyPoint>& kps,
+      const cv::Mat& descs,
+      const FeatureFramePtr& frame,
+      std::vector<obindex2::ImageMatch>* image_matches,
+      PointMatchesMap* point_matches,
+      std::map<unsigned, unsigned>* represented) {
+  // The index already contains all the previous images, so a single search
+  // serves both to query the current image and to insert it. The last p
+  // images are kept in the queue only to discard them as candidates. Unlike
+  // the default mode, the words of those images take part in the ratio test
+  // and the scores of the query, so the results are not the same.
+  queue_ids_.push(image_id);
 
-  if (!islands.size()) {
-    // No resulting islands
-    auto end = std::chrono::steady_clock::now();
-    auto diff = end - start;
-    out_file << 0 << "\t";  // min_id
-    out_file << 0 << "\t";  // max_id
-    out_file << 0 << "\t";  // img_id
-    out_file << 0 << "\t";  // overlap
-    out_file << 0 << "\t";  // Inliers
-    out_file << index_->numDescriptors() << "\t";  // Voc. Size
-    out_file << std::chrono::duration<double, std::milli>(diff).count() << "\t";  // Time
-    out_file << std::endl;
-    return;
+  // The index should not be modified while it is searched. Only this thread
+  // modifies it, so it does not change until the image is inserted.
+  waitInsertions();
+  forgetImages();
+  IndexLock lock(shared_->mutex);
+  if (curr_stats_) {
+    curr_stats_->vocabulary_size = index_->numDescriptors();
   }
 
-  // std::cout << "Resulting Islands:" << std::endl;
-  // for (unsigned i = 0; i < islands.size(); i++) {
-  //   std::cout << islands[i].toString();
-  // }
+  query_matches_.clear();
+  if (index_->numImages() > 0) {
+    StageTimer timer(curr_stats_, STAGE_SEARCH_DESCRIPTORS);
 
-  // Selecting the corresponding island to be processed
-  Island island = islands[0];
-  std::vector<Island> p_islands;
-  getPriorIslands(last_lc_island_, islands, &p_islands);
-  if (p_islands.size()) {
-    island = p_islands[0];
+    // Searching the query descriptors against the features
+    query_feats_.clear();
+    index_->searchDescriptors(descs, &query_feats_, 2, 64);
+
+    // Filtering matches according to the ratio test
+    filterMatches(query_feats_, &query_matches_);
   }
 
-  bool overlap = island.overlaps(last_lc_island_);
-  last_lc_island_ = island;
+  bool enough_images = queue_ids_.size() >= p_;
+  if (enough_images) {
+    // Images up to this one can be considered as loop candidates
+    unsigned last_img_id = queue_ids_.front();
+    queue_ids_.pop();
+
+    // We look for similar images before inserting the current one
+    StageTimer timer(curr_stats_, STAGE_SEARCH_IMAGES);
+    all_matches_.clear();
+    index_->searchImages(descs, query_matches_, &all_matches_, true);
+    toImageIds(shared_->image_ids, &all_matches_);
+    for (unsigned i = 0; i < all_matches_.size(); i++) {
+      if (static_cast<unsigned>(all_matches_[i].image_id) <= last_img_id) {
+        image_matches->push_back(all_matches_[i]);
+      }
+    }
 
-  unsigned best_img = island.img_id;
+    // Correspondences to guide the matching when verifying
+    if (guided_matching_) {
+      index_->getMatchings(kps, query_matches_, point_matches);
+      toImageIds(shared_->image_ids, point_matches);
+    }
+    copyRepresented(*image_matches, represented);
+  }
 
-  // We obtain the image matchings, since we need them for compute F
-  std::vector<cv::DMatch> tmatches;
-  std::vector<cv::Point2f> tquery;
-  std::vector<cv::Point2f> ttrain;
-  ratioMatchingBF(descs, prev_descs_[best_img], &tmatches);
-  convertPoints(kps, prev_kps_[best_img], tmatches, &tquery, &ttrain);
-  unsigned inliers = checkEpipolarGeometry(tquery, ttrain);
-
-  auto end = std::chrono::steady_clock::now();
-  auto diff = end - start;
-
-  // Writing results
-  out_file << island.min_img_id << "\t";          // min_id
-  out_file << island.max_img_id << "\t";          // max_id
-  out_file << best_img << "\t";                   // img_id
-  out_file << overlap << "\t";                    // overlap
-  out_file << inliers << "\t";                    // Inliers
-  out_file << index_->numDescriptors() << "\t";   // Voc. Size
-  out_file << std::chrono::duration<double, std::milli>(diff).count() << "\t";  // Time
-  out_file << std::endl;
+  lock.unlock();
+
+  // Inserting the current image using the same matchings. The inserter is
+  // idle at this point, so they can be handed over to its buffer.
+  if (inserter_) {
+    insert_id_ = image_id;
+    insert_frame_ = shareFrame(image_id, kps, descs, frame);
+    insert_matches_.swap(query_matches_);
+    inserter_->submit([this]() {
+      IndexLock job_lock(shared_->mutex);
+      insertKeyframe(insert_id_, insert_frame_->kps, insert_frame_->descs,
+                     insert_matches_);
+      insert_frame_.reset();
+    });
+  } else {
+    StageTimer timer(curr_stats_, STAGE_INSERT_IMAGE);
+    lock.lock();
+    insertKeyframe(image_id, kps, descs, query_matches_);
+  }
+
+  return enough_images;
+}
+
+void LCDetector::copyRepresented(
+      const std::vector<obindex2::ImageMatch>& image_matches,
+      std::map<unsigned, unsigned>* represented) {
+  if (redundancy_ratio_ <= 0.0f) {
+    return;
+  }
+
+  // Only the candidates can become islands
+  std::unique_lock<std::mutex> lock(represented_mutex_);
+  for (unsigned i = 0; i < image_matches.size(); i++) {
+    auto rep = represented_.find(
+                          static_cast<unsigned>(image_matches[i].image_id));
+    if (rep != represented_.end()) {
+      represented->insert(*rep);
+    }
+  }
+}
+
+void LCDetector::insertNextImage() {
+  // The id of the frame given by the caller is not namespaced
+  unsigned image_id = queue_ids_.front();
+  FeatureFramePtr frame = queue_frames_.front();
+
+  if (inserter_) {
+    insert_id_ = image_id;
+    insert_frame_ = frame;
+    inserter_->submit([this]() {
+      addImage(insert_id_, insert_frame_->kps, insert_frame_->descs);
+      insert_frame_.reset();
+    });
+  } else {
+    addImage(image_id, frame->kps, frame->descs);
+  }
+
+  queue_ids_.pop();
+  queue_frames_.pop();
+}
+
+void LCDetector::waitInsertions() {
+  if (inserter_) {
+    inserter_->wait();
+  }
 }
 
 void LCDetector::addImage(const unsigned image_id,
                           const std::vector<cv::KeyPoint>& kps,
                           const cv::Mat& descs) {
-  if (index_->numImages() == 0) {
-    // This is the first image that is inserted into the index
-    index_->addImage(image_id, kps, descs);
-  } else {
-    // We have to search the descriptor and filter them before adding descs
-    // Matching the descriptors
-    std::vector<std::vector<cv::DMatch> > matches_feats;
+  IndexLock lock(shared_->mutex);
+  matchIndex(index_.get(), descs, &insert_feats_, &insert_matches_);
+  insertKeyframe(image_id, kps, descs, insert_matches_);
+}
 
+void LCDetector::matchIndex(
+      obindex2::ImageIndex* index,
+      const cv::Mat& descs,
+      std::vector<std::vector<cv::DMatch> >* matches_feats,
+      std::vector<cv::DMatch>* matches) {
+  matches->clear();
+  if (index->numImages() > 0) {
+    // We have to search the descriptor and filter them before adding descs
     // Searching the query descriptors against the features
-    index_->searchDescriptors(descs, &matches_feats, 2, 64);
+    matches_feats->clear();
+    index->searchDescriptors(descs, matches_feats, 2, 64);
 
     // Filtering matches according to the ratio test
-    std::vector<cv::DMatch> matches;
-    filterMatches(matches_feats, &matches);
+    filterMatches(*matches_feats, matches);
+  }
+}
+
+void LCDetector::insertKeyframe(const unsigned image_id,
+                                const std::vector<cv::KeyPoint>& kps,
+                                const cv::Mat& descs,
+                                const std::vector<cv::DMatch>& matches) {
+  // An image is redundant if most of its features match visual words
+  if (redundancy_ratio_ > 0.0f && !indexed_ids_.empty() && descs.rows > 0 &&
+      matches.size() >= redundancy_ratio_ * descs.rows) {
+    // It will never be a candidate, so it takes no position in the index and
+    // its keyframe is not needed
+    unsigned rep = indexed_ids_.back();
+    {
+      std::unique_lock<std::mutex> lock(represented_mutex_);
+      represented_[rep] = image_id;
+    }
+    kf_store_->remove(image_id);
+    return;
+  }
 
+  insertImage(image_id, kps, descs, matches);
+}
+
+unsigned LCDetector::representative(const unsigned image_id) {
+  std::unique_lock<std::mutex> lock(represented_mutex_);
+  auto it = represented_.upper_bound(image_id);
+  if (it == represented_.begin()) {
+    return image_id;
+  }
+
+  it--;
+  return image_id <= it->second ? it->first : image_id;
+}
+
+void LCDetector::insertImage(const unsigned image_id,
+                             const std::vector<cv::KeyPoint>& kps,
+                             const cv::Mat& descs,
+                             const std::vector<cv::DMatch>& matches) {
+  // Recording the insertion to be able to rebuild the index later
+  indexed_ids_.push_back(image_id);
+  if (snapshots_) {
+    journal_.push_back(IndexInsertion());
+    journal_.back().image_id = image_id;
+    journal_.back().matches = matches;
+  }
+
+  unsigned position = shared_->image_ids.size();
+  shared_->image_ids.push_back(image_id);
+  if (index_->numImages() == 0) {
+    // This is the first image that is inserted into the index
+    index_->addImage(position, kps, descs);
+  } else {
     // Finally, we add the image taking into account the correct matchings
-    index_->addImage(image_id, kps, descs, matches);
+    index_->addImage(position, kps, descs, matches);
+  }
+  shared_->num_descriptors = index_->numDescriptors();
+}
+
+void LCDetector::forgetImages() {
+  if (forget_policy_ == FORGET_NONE || !max_indexed_images_) {
+    return;
+  }
+
+  if (!rebuilding_) {
+    if (indexed_ids_.size() > max_indexed_images_ + forget_step_) {
+      StageTimer timer(curr_stats_, STAGE_INSERT_IMAGE);
+      startRebuild();
+    }
+    return;
+  }
+
+  // The current index is used until the new one replaces it. Meanwhile, the
+  // images indexed are also inserted into the new one in the background, in
+  // order, whenever the worker is idle.
+  if (indexed_ids_.size() - rebuild_start_ < forget_step_ / 2) {
+    if (indexed_ids_.size() - rebuild_from_ >= kCatchUpChunk &&
+        rebuilder_->idle()) {
+      std::vector<unsigned> chunk(indexed_ids_.begin() + rebuild_from_,
+                                  indexed_ids_.end());
+      rebuild_from_ = indexed_ids_.size();
+      rebuilder_->submit([this, chunk]() {
+        reinsertImages(chunk);
+      });
+    }
+    return;
+  }
+
+  // The images left are inserted by this thread
+  StageTimer timer(curr_stats_, STAGE_INSERT_IMAGE);
+  rebuilder_->wait();
+  std::vector<unsigned> backlog(indexed_ids_.begin() + rebuild_from_,
+                                indexed_ids_.end());
+  reinsertImages(backlog);
+  finishRebuild();
+}
+
+void LCDetector::selectRetained(const std::vector<unsigned>& image_ids,
+                                std::vector<unsigned>* retained) {
+  retained->clear();
+  unsigned nimages = image_ids.size();
+
+  if (forget_policy_ == FORGET_OLDEST) {
+    retained->assign(image_ids.end() - max_indexed_images_, image_ids.end());
+    return;
+  }
+
+  // The most recent half is kept as is, and the oldest images are reduced to
+  // one per island. Islands grow until everything fits in the index, so the
+  // whole sequence is still covered, each time more sparsely.
+  unsigned nrecent = max_indexed_images_ / 2;
+  unsigned bucket_size = std::max(island_size_, 1u);
+  while (true) {
+    retained->clear();
+    unsigned last_bucket = 0;
+    for (unsigned i = 0; i < nimages - nrecent; i++) {
+      unsigned bucket = image_ids[i] / bucket_size + 1;
+      if (bucket != last_bucket) {
+        retained->push_back(image_ids[i]);
+        last_bucket = bucket;
+      }
+    }
+
+    if (retained->size() + nrecent <= max_indexed_images_) {
+      break;
+    }
+    bucket_size *= 2;
+  }
+
+  retained->insert(retained->end(), image_ids.end() - nrecent,
+                   image_ids.end());
+}
+
+void LCDetector::startRebuild() {
+  std::vector<unsigned> retained;
+  selectRetained(indexed_ids_, &retained);
+
+  // The forgotten images can still be candidates until the index is replaced
+  forgotten_ids_.clear();
+  unsigned r = 0;
+  for (unsigned i = 0; i < indexed_ids_.size(); i++) {
+    if (r < retained.size() && retained[r] == indexed_ids_[i]) {
+      r++;
+    } else {
+      forgotten_ids_.push_back(indexed_ids_[i]);
+    }
+  }
+
+  next_index_ = std::make_shared<obindex2::ImageIndex>(
+                                            index_params_.k,
+                                            index_params_.s,
+                                            index_params_.t,
+                                            index_params_.merge_policy,
+                                            index_params_.purge_descriptors,
+                                            index_params_.min_feat_apps);
+  next_ids_.clear();
+  next_journal_.clear();
+  rebuild_start_ = indexed_ids_.size();
+  rebuild_from_ = indexed_ids_.size();
+  rebuilding_ = true;
+
+  rebuilder_->submit([this, retained]() {
+    reinsertImages(retained);
+  });
+}
+
+void LCDetector::reinsertImages(const std::vector<unsigned>& image_ids) {
+  // obindex2 cannot remove images, so the retained ones are inserted again
+  // into a new index, in the same order. It is not shared until it replaces
+  // the current one, so no lock is needed.
+  for (unsigned i = 0; i < image_ids.size(); i++) {
+    std::shared_ptr<const Keyframe> kf = kf_store_->get(image_ids[i]);
+    if (!kf) {
+      // Dropped by the keyframe store, so it could not be verified anyway
+      continue;
+    }
+
+    // They were already selected as keyframes. As in the current index,
+    // their position in the new one is used as their id in obindex2.
+    std::vector<cv::KeyPoint> kps;
+    cv::KeyPoint::convert(kf->pts, kps);
+    matchIndex(next_index_.get(), kf->descs, &rebuild_feats_,
+               &rebuild_matches_);
+    unsigned position = next_ids_.size();
+    if (next_index_->numImages() == 0) {
+      next_index_->addImage(position, kps, kf->descs);
+    } else {
+      next_index_->addImage(position, kps, kf->descs, rebuild_matches_);
+    }
+
+    next_ids_.push_back(image_ids[i]);
+    if (snapshots_) {
+      next_journal_.push_back(IndexInsertion());
+      next_journal_.back().image_id = image_ids[i];
+      next_journal_.back().matches = rebuild_matches_;
+    }
+  }
+}
+
+void LCDetector::finishRebuild() {
+  // The old index is released once the lock is, since it can be large
+  std::shared_ptr<obindex2::ImageIndex> old_index = index_;
+  {
+    IndexLock lock(shared_->mutex);
+    index_ = next_index_;
+    shared_->index = index_;
+    shared_->image_ids = next_ids_;
+    indexed_ids_.swap(next_ids_);
+    journal_.swap(next_journal_);
+    shared_->num_descriptors = index_->numDescriptors();
   }
+  next_index_.reset();
+  next_ids_.clear();
+  next_journal_.clear();
+  rebuilding_ = false;
+
+  dropped_ids_.insert(dropped_ids_.end(), forgotten_ids_.begin(),
+                      forgotten_ids_.end());
+  forgotten_ids_.clear();
+  if (!in_batch_) {
+    dropForgotten();
+  }
+}
+
+void LCDetector::dropForgotten() {
+  // Forgotten images will never be verified again
+  for (unsigned i = 0; i < dropped_ids_.size(); i++) {
+    kf_store_->remove(dropped_ids_[i]);
+    std::unique_lock<std::mutex> lock(represented_mutex_);
+    represented_.erase(dropped_ids_[i]);
+  }
+  dropped_ids_.clear();
 }
 
 void LCDetector::filterMatches(
@@ -320,11 +1494,32 @@ void LCDetector::filterMatches(
   }
 }
 
+void LCDetectorSearch::trim(const double min_score) {
+  // The last match is kept, since the scores are normalized with it
+  double max_s = image_matches.empty() ? 0.0 : image_matches.front().score;
+  double min_s = image_matches.empty() ? 0.0 : image_matches.back().score;
+  unsigned nkept = 0;
+  while (nkept + 1 < image_matches.size() &&
+         (image_matches[nkept].score - min_s) / (max_s - min_s) > min_score) {
+    nkept++;
+  }
+
+  if (nkept + 1 < image_matches.size()) {
+    image_matches[nkept] = image_matches.back();
+    image_matches.resize(nkept + 1);
+  }
+  std::vector<obindex2::ImageMatch>(image_matches).swap(image_matches);
+}
+
 void LCDetector::filterCandidates(
       const std::vector<obindex2::ImageMatch>& image_matches,
       std::vector<obindex2::ImageMatch>* image_matches_filt) {
   image_matches_filt->clear();
 
+  if (image_matches.empty()) {
+    return;
+  }
+
   double max_score = image_matches[0].score;
   double min_score = image_matches[image_matches.size() - 1].score;
 
@@ -343,129 +1538,240 @@ void LCDetector::filterCandidates(
   }
 }
 
-void LCDetector::buildIslands(
+void LCDetector::getIslands(
       const std::vector<obindex2::ImageMatch>& image_matches,
-      std::vector<Island>* islands) {
-  islands->clear();
+      const std::map<unsigned, unsigned>& represented,
+      ImageBuffers* bufs,
+      std::vector<Island>* islands,
+      LCDetectorStats* stats) {
+  StageTimer timer(stats, STAGE_ISLANDS);
 
-  // We process each of the resulting image matchings
-  for (unsigned i = 0; i < image_matches.size(); i++) {
-    // Getting information about this match
-    unsigned curr_img_id = static_cast<unsigned>(image_matches[i].image_id);
-    double curr_score = image_matches[i].score;
-
-    // Theoretical island limits
-    unsigned min_id = static_cast<unsigned>
-                              (std::max((int)curr_img_id - (int)island_offset_,
-                               0));
-    unsigned max_id = curr_img_id + island_offset_;
-
-    // We search for the closest island
-    bool found = false;
-    for (unsigned j = 0; j < islands->size(); j++) {
-      if (islands->at(j).fits(curr_img_id)) {
-        islands->at(j).incrementScore(curr_score);
-        found = true;
-        break;
-      } else {
-        // We adjust the limits of a future island
-        islands->at(j).adjustLimits(curr_img_id, &min_id, &max_id);
-      }
+  // Filtering the resulting image matchings
+  filterCandidates(image_matches, &bufs->candidates);
+
+  bufs->builder.build(bufs->candidates, island_offset_,
+                      represented.empty() ? nullptr : &represented, islands);
+
+  if (stats) {
+    stats->islands = islands->size();
+  }
+}
+
+Island LCDetector::selectIsland(const std::vector<Island>& islands,
+                                bool* overlap) {
+  // The best island overlapping the last one, if any
+  unsigned best = 0;
+  for (unsigned i = 0; i < islands.size(); i++) {
+    if (last_lc_island_.overlaps(islands[i])) {
+      best = i;
+      break;
     }
+  }
+  Island island = islands[best];
+
+  *overlap = island.overlaps(last_lc_island_);
+  last_lc_island_ = island;
+
+  return island;
+}
 
-    // Creating a new island if required
-    if (!found) {
-      Island new_island(curr_img_id,
-                        curr_score,
-                        min_id,
-                        max_id);
-      islands->push_back(new_island);
+unsigned LCDetector::verifyLoop(const Keyframe& query,
+                                const unsigned train_id,
+                                const PointMatchesMap& point_matches,
+                                ImageBuffers* bufs,
+                                LCDetectorStats* stats) {
+  // We obtain the image matchings, since we need them for compute F
+  std::vector<cv::DMatch>& tmatches = bufs->matches;
+  tmatches.clear();
+  bufs->query.clear();
+  bufs->train.clear();
+  {
+    StageTimer timer(stats, STAGE_MATCHING);
+    std::shared_ptr<const Keyframe> train_kf = kf_store_->get(train_id);
+    if (train_kf) {
+      auto prior = point_matches.find(train_id);
+      if (prior == point_matches.end() ||
+          !guidedMatching(query, *train_kf, prior->second, bufs)) {
+        ratioMatchingBF(query.descs, train_kf->descs, &tmatches);
+      }
+      if (verifier_->sortedMatches()) {
+        std::stable_sort(tmatches.begin(), tmatches.end());
+      }
+      gatherPoints(query.pts, train_kf->pts, tmatches, &bufs->query,
+                   &bufs->train);
     }
   }
 
-  // Normalizing the final scores according to the number of images
-  for (unsigned j = 0; j < islands->size(); j++) {
-    islands->at(j).normalizeScore();
+  if (stats) {
+    stats->putative_matches += tmatches.size();
   }
 
-  std::sort(islands->begin(), islands->end());
+  StageTimer timer(stats, STAGE_GEOMETRY);
+  return checkEpipolarGeometry(bufs);
 }
 
-void LCDetector::getPriorIslands(
-      const Island& island,
-      const std::vector<Island>& islands,
-      std::vector<Island>* p_islands) {
-  p_islands->clear();
+LCDetector::ImageBuffers* LCDetector::imageBuffers(
+                                                        const unsigned n) {
+  // Only grown outside of the parallel regions, so the buffers handed out
+  // stay valid while they are used
+  if (image_bufs_.size() < n) {
+    image_bufs_.resize(n);
+  }
 
-  // We search for overlapping islands
-  for (unsigned i = 0; i < islands.size(); i++) {
-    Island tisl = islands[i];
-    if (island.overlaps(tisl)) {
-      p_islands->push_back(tisl);
+  return image_bufs_.data();
+}
+
+int LCDetector::verifyIslands(const Keyframe& query,
+                              const std::vector<Island>& candidates,
+                              const PointMatchesMap& point_matches,
+                              std::vector<unsigned>* inliers,
+                              LCDetectorStats* stats) {
+  int ncands = static_cast<int>(candidates.size());
+  inliers->assign(ncands, 0);
+
+  // Each candidate is timed on its own, since they run concurrently
+  std::vector<LCDetectorStats>& cand_stats = cand_stats_;
+  cand_stats.assign(stats ? ncands : 0, LCDetectorStats());
+
+  // First candidate accepted so far. The following ones are cancelled, so
+  // the result does not depend on the order in which they finish
+  std::atomic<int> accepted(ncands);
+
+  ImageBuffers* bufs = imageBuffers(ncands);
+  #pragma omp parallel for schedule(dynamic, 1)
+  for (int i = 0; i < ncands; i++) {
+    if (i > accepted.load()) {
+      continue;
+    }
+
+    unsigned cand_inliers = verifyLoop(query, candidates[i].img_id,
+                                       point_matches, &bufs[i],
+                                       stats ? &cand_stats[i] : nullptr);
+    inliers->at(i) = cand_inliers;
+
+    if (cand_inliers > min_inliers_) {
+      int curr = accepted.load();
+      while (i < curr && !accepted.compare_exchange_weak(curr, i)) {}
     }
   }
+
+  // The candidates after the accepted one may or may not have been verified
+  // before being cancelled, so only the previous ones are reported
+  int first = accepted.load();
+  unsigned nverified = first < ncands ? first + 1 : ncands;
+  inliers->resize(nverified);
+
+  for (unsigned i = 0; i < cand_stats.size(); i++) {
+    stats->time[STAGE_MATCHING] += cand_stats[i].time[STAGE_MATCHING];
+    stats->time[STAGE_GEOMETRY] += cand_stats[i].time[STAGE_GEOMETRY];
+    if (i < nverified) {
+      stats->putative_matches += cand_stats[i].putative_matches;
+    }
+  }
+
+  return first < ncands ? first : -1;
 }
 
-unsigned LCDetector::checkEpipolarGeometry(
-                                      const std::vector<cv::Point2f>& query,
-                                      const std::vector<cv::Point2f>& train) {
-  std::vector<uchar> inliers(query.size(), 0);
-  if (query.size() > 7) {
-    cv::Mat F =
-      cv::findFundamentalMat(
-        cv::Mat(query), cv::Mat(train),      // Matching points
-        cv::FM_RANSAC,                        // RANSAC method
-        ep_dist_,                                 // Distance to epipolar line
-        conf_prob_,                              // Confidence probability
-        inliers);                            // Match status (inlier or outlier)
+void LCDetector::assessLoop(const unsigned best_img,
+                            const bool assumed,
+                            const unsigned inliers,
+                            LCDetectorResult* result) {
+  result->train_session = imageSession(best_img);
+  if (assumed) {
+    // LOOP can be considered as detected
+    result->status = LC_DETECTED;
+    result->train_id = best_img;
+    result->inliers = 0;
+    // Store the last result
+    last_lc_result_ = *result;
+    consecutive_loops_++;
+  } else if (inliers > min_inliers_) {
+    // LOOP detected
+    result->status = LC_DETECTED;
+    result->train_id = best_img;
+    result->inliers = inliers;
+    // Store the last result
+    last_lc_result_ = *result;
+    consecutive_loops_++;
+  } else {
+    result->status = LC_NOT_ENOUGH_INLIERS;
+    result->train_id = best_img;
+    result->inliers = inliers;
+    last_lc_result_.status = LC_NOT_ENOUGH_INLIERS;
+    consecutive_loops_ = 0;
   }
+}
 
-  // Extract the surviving (inliers) matches
-  auto it = inliers.begin();
-  unsigned total_inliers = 0;
-  for (; it != inliers.end(); it++) {
-    if (*it)
-      total_inliers++;
+unsigned LCDetector::checkEpipolarGeometry(ImageBuffers* bufs) {
+  // There are not enough matches to ever reach the minimum number of inliers
+  if (early_exit_verification_ && bufs->query.size() <= min_inliers_) {
+    return 0;
   }
 
-  return total_inliers;
+  return verifier_->countInliers(bufs->query, bufs->train, &bufs->mask);
 }
 
-void LCDetector::ratioMatchingBF(const cv::Mat& query,
-                                 const cv::Mat& train,
-                                 std::vector<cv::DMatch>* matches) {
-  matches->clear();
-  cv::BFMatcher matcher(cv::NORM_HAMMING);
+bool LCDetector::guidedMatching(const Keyframe& query,
+                                const Keyframe& train_kf,
+                                const obindex2::PointMatches& prior,
+                                ImageBuffers* bufs) {
+  // Too few correspondences to predict where the query points should be
+  if (prior.query.size() < 8) {
+    return false;
+  }
 
-  // Matching descriptors
-  std::vector<std::vector<cv::DMatch> > matches12;
-  matcher.knnMatch(query, train, matches12, 2);
+  // Coarse similarity between both images from the index correspondences
+  cv::Mat transform = cv::estimateAffinePartial2D(prior.query, prior.train,
+                                                  cv::noArray(), cv::RANSAC,
+                                                  guided_radius_ / 2.0);
+  if (transform.empty()) {
+    return false;
+  }
 
-  // Filtering the resulting matchings according to the given ratio
-  for (unsigned m = 0; m < matches12.size(); m++) {
-    if (matches12[m][0].distance <= matches12[m][1].distance * nndr_bf_) {
-      matches->push_back(matches12[m][0]);
+  // A degenerate set of correspondences can produce a non-finite model
+  for (int i = 0; i < 6; i++) {
+    if (!std::isfinite(transform.at<double>(i / 3, i % 3))) {
+      return false;
     }
   }
+
+  // Predicting the position of each query point in the train image
+  double a = transform.at<double>(0, 0);
+  double b = transform.at<double>(0, 1);
+  double tx = transform.at<double>(0, 2);
+  double c = transform.at<double>(1, 0);
+  double d = transform.at<double>(1, 1);
+  double ty = transform.at<double>(1, 2);
+  std::vector<cv::Point2f>& predicted = bufs->predicted;
+  predicted.resize(query.pts.size());
+  for (unsigned i = 0; i < query.pts.size(); i++) {
+    const cv::Point2f& pt = query.pts[i];
+    predicted[i].x = static_cast<float>(a * pt.x + b * pt.y + tx);
+    predicted[i].y = static_cast<float>(c * pt.x + d * pt.y + ty);
+  }
+
+  guidedRatioMatchHamming(query.descs, predicted, train_kf.descs, train_kf.pts,
+                          guided_radius_, nndr_bf_, &bufs->grid,
+                          &bufs->matches);
+  return true;
 }
 
-void LCDetector::convertPoints(const std::vector<cv::KeyPoint>& query_kps,
-                               const std::vector<cv::KeyPoint>& train_kps,
-                               const std::vector<cv::DMatch>& matches,
-                               std::vector<cv::Point2f>* query,
-                               std::vector<cv::Point2f>* train) {
-  query->clear();
-  train->clear();
-  for (auto it = matches.begin(); it != matches.end(); it++) {
-    // Get the position of query keypoints
-    float x = query_kps[it->queryIdx].pt.x;
-    float y = query_kps[it->queryIdx].pt.y;
-    query->push_back(cv::Point2f(x, y));
+void LCDetector::ratioMatchingBF(const cv::Mat& query,
+                                 const cv::Mat& train,
+                                 std::vector<cv::DMatch>* matches) {
+  ratioMatchHamming(query, train, nndr_bf_, bf_matcher_, matches);
+}
 
-    // Get the position of train keypoints
-    x = train_kps[it->trainIdx].pt.x;
-    y = train_kps[it->trainIdx].pt.y;
-    train->push_back(cv::Point2f(x, y));
+void LCDetector::gatherPoints(const std::vector<cv::Point2f>& query_pts,
+                              const std::vector<cv::Point2f>& train_pts,
+                              const std::vector<cv::DMatch>& matches,
+                              std::vector<cv::Point2f>* query,
+                              std::vector<cv::Point2f>* train) {
+  query->resize(matches.size());
+  train->resize(matches.size());
+  for (unsigned i = 0; i < matches.size(); i++) {
+    (*query)[i] = query_pts[matches[i].queryIdx];
+    (*train)[i] = train_pts[matches[i].trainIdx];
   }
 }
 
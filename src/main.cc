@@ -22,6 +22,7 @@
 #include <boost/filesystem.hpp>
 #include <opencv2/features2d.hpp>
 
+#include "ibow-lcd/feature_pipeline.h"
 #include "ibow-lcd/lcdetector.h"
 
 void getFilenames(const std::string& directory,
@@ -47,32 +48,30 @@ void getFilenames(const std::string& directory,
 }
 
 int main(int argc, char** argv) {
-  // Creating feature detector and descriptor
-  cv::Ptr<cv::Feature2D> detector = cv::ORB::create(1500);  // Default params
-
   // Loading image filenames
   std::vector<std::string> filenames;
   getFilenames(argv[1], &filenames);
-  unsigned nimages = filenames.size();
+
+  // Images are loaded and described in the background
+  ibow_lcd::FeaturePipeline pipeline(filenames, []() {
+    // Creating feature detector and descriptor
+    return cv::ORB::create(1500);  // Default params
+  });
 
   // Creating the loop closure detector object
   ibow_lcd::LCDetectorParams params;  // Assign desired parameters
   ibow_lcd::LCDetector lcdet(params);
 
   // Processing the sequence of images
-  for (unsigned i = 0; i < nimages; i++) {
+  ibow_lcd::FeatureFrame frame;
+  while (pipeline.next(&frame)) {
     // Processing image i
+    unsigned i = frame.image_id;
     std::cout << "--- Processing image " << i << std::endl;
 
-    // Loading and describing the image
-    cv::Mat img = cv::imread(filenames[i]);
-    std::vector<cv::KeyPoint> kps;
-    detector->detect(img, kps);
-    cv::Mat dscs;
-    detector->compute(img, kps, dscs);
-
     ibow_lcd::LCDetectorResult result;
-    lcdet.process(i, kps, dscs, &result);
+    // The frame is handed over, so the detector does not copy it
+    lcdet.process(std::move(frame), &result);
 
     switch (result.status) {
       case ibow_lcd::LC_DETECTED:
@@ -0,0 +1,184 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "ibow-lcd/result_sink.h"
+
+#include <cstring>
+
+namespace ibow_lcd {
+
+namespace {
+
+const char kTraceMagic[8] = {'I', 'B', 'O', 'W', 'T', 'R', 'C', '\0'};
+const uint32_t kTraceVersion = 1;
+
+// Fields of a record, in order
+struct TraceRecord {
+  uint32_t query_id;
+  int32_t status;
+  uint32_t train_id;
+  uint32_t inliers;
+  uint32_t min_id;
+  uint32_t max_id;
+  uint32_t img_id;
+  uint8_t overlap;
+  uint8_t assumed;
+  uint8_t padding[2];
+  uint32_t trace_inliers;
+  uint32_t vocabulary_size;
+  double time;
+};
+
+}  // namespace
+
+void MemorySink::write(const LCDetectorResult& result,
+                       const LCDetectorTrace& trace) {
+  results_.push_back(result);
+  traces_.push_back(trace);
+}
+
+TsvSink::TsvSink(const std::string& filename, const size_t buffer_size) :
+    out_(filename),
+    buffer_size_(buffer_size) {
+  traces_.reserve(buffer_size_);
+}
+
+TsvSink::~TsvSink() {
+  flush();
+}
+
+void TsvSink::write(const LCDetectorResult& result,
+                    const LCDetectorTrace& trace) {
+  traces_.push_back(trace);
+  if (traces_.size() >= buffer_size_) {
+    flush();
+  }
+}
+
+bool TsvSink::flush() {
+  for (unsigned i = 0; i < traces_.size(); i++) {
+    const LCDetectorTrace& trace = traces_[i];
+    out_ << trace.min_id << "\t";           // min_id
+    out_ << trace.max_id << "\t";           // max_id
+    out_ << trace.img_id << "\t";           // img_id
+    out_ << trace.overlap << "\t";          // overlap
+    out_ << trace.inliers << "\t";          // Inliers
+    out_ << trace.vocabulary_size << "\t";  // Voc. Size
+    out_ << trace.time << "\t";             // Time
+    out_ << "\n";
+  }
+  traces_.clear();
+
+  out_.flush();
+  return out_.good();
+}
+
+BinarySink::BinarySink(const std::string& filename,
+                       const size_t buffer_size) :
+    out_(filename, std::ios::binary),
+    buffer_size_(buffer_size) {
+  buffer_.reserve(buffer_size_ + sizeof(TraceRecord));
+  out_.write(kTraceMagic, sizeof(kTraceMagic));
+  out_.write(reinterpret_cast<const char*>(&kTraceVersion),
+             sizeof(kTraceVersion));
+}
+
+BinarySink::~BinarySink() {
+  flush();
+}
+
+void BinarySink::write(const LCDetectorResult& result,
+                       const LCDetectorTrace& trace) {
+  TraceRecord rec;
+  std::memset(&rec, 0, sizeof(rec));
+  rec.query_id = result.query_id;
+  rec.status = result.status;
+  rec.train_id = result.train_id;
+  rec.inliers = result.inliers;
+  rec.min_id = trace.min_id;
+  rec.max_id = trace.max_id;
+  rec.img_id = trace.img_id;
+  rec.overlap = trace.overlap;
+  rec.assumed = trace.assumed;
+  rec.trace_inliers = trace.inliers;
+  rec.vocabulary_size = trace.vocabulary_size;
+  rec.time = trace.time;
+
+  const char* bytes = reinterpret_cast<const char*>(&rec);
+  buffer_.insert(buffer_.end(), bytes, bytes + sizeof(rec));
+  if (buffer_.size() >= buffer_size_) {
+    flush();
+  }
+}
+
+bool BinarySink::flush() {
+  out_.write(buffer_.data(), buffer_.size());
+  buffer_.clear();
+
+  out_.flush();
+  return out_.good();
+}
+
+bool BinarySink::read(const std::string& filename,
+                      std::vector<LCDetectorResult>* results,
+                      std::vector<LCDetectorTrace>* traces) {
+  results->clear();
+  traces->clear();
+
+  std::ifstream in(filename, std::ios::binary);
+  if (!in.is_open()) {
+    return false;
+  }
+
+  char magic[sizeof(kTraceMagic)];
+  uint32_t version = 0;
+  in.read(magic, sizeof(magic));
+  in.read(reinterpret_cast<char*>(&version), sizeof(version));
+  if (!in.good() || std::memcmp(magic, kTraceMagic, sizeof(magic)) ||
+      version != kTraceVersion) {
+    return false;
+  }
+
+  TraceRecord rec;
+  while (in.read(reinterpret_cast<char*>(&rec), sizeof(rec))) {
+    LCDetectorResult result;
+    result.query_id = rec.query_id;
+    result.status = static_cast<LCDetectorStatus>(rec.status);
+    result.train_id = rec.train_id;
+    result.inliers = rec.inliers;
+    results->push_back(result);
+
+    LCDetectorTrace trace;
+    trace.min_id = rec.min_id;
+    trace.max_id = rec.max_id;
+    trace.img_id = rec.img_id;
+    trace.overlap = rec.overlap;
+    trace.assumed = rec.assumed;
+    trace.inliers = rec.trace_inliers;
+    trace.vocabulary_size = rec.vocabulary_size;
+    trace.time = rec.time;
+    traces->push_back(trace);
+  }
+
+  // A partial record means a truncated file
+  return in.gcount() == 0;
+}
+
+}  // namespace ibow_lcd
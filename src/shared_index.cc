@@ -0,0 +1,39 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ibow-lcd/shared_index.h"
+
+#include "ibow-lcd/lcdetector.h"
+
+namespace ibow_lcd {
+
+SharedIndex::SharedIndex(const LCDetectorParams& params) :
+    num_descriptors(0) {
+  index = std::make_shared<obindex2::ImageIndex>(params.k,
+                                                 params.s,
+                                                 params.t,
+                                                 params.merge_policy,
+                                                 params.purge_descriptors,
+                                                 params.min_feat_apps);
+  kf_store = std::make_shared<KeyframeStore>(
+                              static_cast<size_t>(params.kf_budget) << 20,
+                              params.kf_spill_dir);
+}
+
+}  // namespace ibow_lcd
@@ -0,0 +1,90 @@
+/**
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ibow-lcd/worker_thread.h"
+
+namespace ibow_lcd {
+
+WorkerThread::WorkerThread(const unsigned max_jobs) :
+    max_jobs_(max_jobs ? max_jobs : 1),
+    busy_(false),
+    stop_(false),
+    jobs_(max_jobs_),
+    first_job_(0),
+    njobs_(0) {
+  thread_ = std::thread(&WorkerThread::run, this);
+}
+
+WorkerThread::~WorkerThread() {
+  // Pending jobs are completed before stopping the thread
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  thread_.join();
+}
+
+void WorkerThread::submit(const std::function<void()>& job) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.wait(lock, [this] { return njobs_ < max_jobs_; });
+  jobs_[(first_job_ + njobs_) % max_jobs_] = job;
+  njobs_++;
+  cond_.notify_all();
+}
+
+void WorkerThread::wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.wait(lock, [this] { return njobs_ == 0 && !busy_; });
+}
+
+bool WorkerThread::idle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return njobs_ == 0 && !busy_;
+}
+
+void WorkerThread::run() {
+  std::function<void()> job;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this] { return stop_ || njobs_ > 0; });
+      if (njobs_ == 0) {
+        // Stopping and nothing else to do
+        return;
+      }
+      job.swap(jobs_[first_job_]);
+      first_job_ = (first_job_ + 1) % max_jobs_;
+      njobs_--;
+      busy_ = true;
+    }
+    cond_.notify_all();
+
+    job();
+    job = nullptr;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      busy_ = false;
+    }
+    cond_.notify_all();
+  }
+}
+
+}  // namespace ibow_lcd
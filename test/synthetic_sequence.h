@@ -0,0 +1,95 @@
+/*
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TEST_SYNTHETIC_SEQUENCE_H_
+#define TEST_SYNTHETIC_SEQUENCE_H_
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+namespace ibow_lcd {
+
+// SyntheticSequence: frames of a set of places, so that the tests do not need
+// any dataset. Each place has its own random ORB-like descriptors, and each
+// visit to a place only flips a few bits of them. The keypoints do not move
+// between visits, so any geometric model holds between them. A few features
+// are seen from every place, so that all the images are scored.
+class SyntheticSequence {
+ public:
+  SyntheticSequence(const unsigned nplaces,
+                    const unsigned nfeats,
+                    const unsigned seed = 42) :
+      nplaces_(nplaces),
+      nfeats_(nfeats) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::uniform_real_distribution<float> x(0.0f, 640.0f);
+    std::uniform_real_distribution<float> y(0.0f, 480.0f);
+    descs_.resize(nplaces);
+    kps_.resize(nplaces);
+    for (unsigned p = 0; p < nplaces; p++) {
+      descs_[p] = cv::Mat(nfeats, 32, CV_8U);
+      for (unsigned i = 0; i < nfeats; i++) {
+        if (p > 0 && i < kSharedFeats) {
+          memcpy(descs_[p].ptr(i), descs_[0].ptr(i), 32);
+          kps_[p].push_back(kps_[0][i]);
+          continue;
+        }
+
+        for (unsigned b = 0; b < 32; b++) {
+          descs_[p].at<uchar>(i, b) = static_cast<uchar>(byte(rng));
+        }
+        kps_[p].push_back(cv::KeyPoint(x(rng), y(rng), 31.0f));
+      }
+    }
+  }
+
+  inline unsigned numPlaces() const {
+    return nplaces_;
+  }
+
+  // Features of the given visit to a place
+  void frame(const unsigned place,
+             const unsigned visit,
+             std::vector<cv::KeyPoint>* kps,
+             cv::Mat* descs) const {
+    *kps = kps_[place];
+    *descs = descs_[place].clone();
+    uchar bit = static_cast<uchar>(1 << (visit % 8));
+    for (unsigned i = 0; i < nfeats_; i++) {
+      descs->at<uchar>(i, (i + visit) % 32) ^= bit;
+    }
+  }
+
+ private:
+  static const unsigned kSharedFeats = 10;
+
+  unsigned nplaces_;
+  unsigned nfeats_;
+  std::vector<cv::Mat> descs_;
+  std::vector<std::vector<cv::KeyPoint> > kps_;
+};
+
+}  // namespace ibow_lcd
+
+#endif  // TEST_SYNTHETIC_SEQUENCE_H_
@@ -0,0 +1,125 @@
+/*
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "allocation_counter.h"
+#include "ibow-lcd/hamming_matcher.h"
+#include "ibow-lcd/island_builder.h"
+#include "ibow-lcd/lcdetector.h"
+#include "ibow-lcd/worker_thread.h"
+#include "synthetic_sequence.h"
+
+namespace ibow_lcd {
+
+TEST(Allocations, ReplayingFreesNothingItAllocates) {
+  const unsigned nplaces = 40;
+  SyntheticSequence seq(nplaces, 100);
+  LCDetectorParams params;
+  params.p = 5;
+
+  // A sequence revisiting the first places
+  std::vector<std::vector<cv::KeyPoint> > kps;
+  std::vector<cv::Mat> descs;
+  for (unsigned i = 0; i < nplaces + 30; i++) {
+    kps.push_back(std::vector<cv::KeyPoint>());
+    descs.push_back(cv::Mat());
+    seq.frame(i % nplaces, i / nplaces, &kps.back(), &descs.back());
+  }
+
+  // Searching it, so that the index is out of the replay
+  LCDetector searcher(params);
+  std::vector<LCDetectorSearch> searches(kps.size());
+  for (unsigned i = 0; i < kps.size(); i++) {
+    searcher.search(i, kps[i], descs[i], &searches[i]);
+  }
+
+  // Once the loops are assumed, an image only allocates its keyframe. The
+  // first ones of the revisit are verified, and OpenCV allocates then.
+  LCDetector lcdet(params);
+  LCDetectorResult result;
+  unsigned nwarmup = nplaces + params.min_consecutive_loops + 5;
+  for (unsigned i = 0; i < kps.size(); i++) {
+    if (i == nwarmup) {
+      markAllocations();
+    }
+    lcdet.replay(i, kps[i], descs[i], searches[i], &result);
+    if (i >= nwarmup) {
+      ASSERT_EQ(LC_DETECTED, result.status) << "image " << i;
+      ASSERT_EQ(0u, result.inliers) << "image " << i;
+    }
+  }
+  EXPECT_EQ(0u, numTransientAllocations());
+}
+
+TEST(Allocations, MatchingReusesItsBuffers) {
+  SyntheticSequence seq(2, 200);
+  std::vector<cv::KeyPoint> kps;
+  cv::Mat query;
+  cv::Mat train;
+  seq.frame(0, 1, &kps, &query);
+  seq.frame(0, 0, &kps, &train);
+  std::vector<cv::Point2f> pts;
+  cv::KeyPoint::convert(kps, pts);
+
+  std::vector<obindex2::ImageMatch> candidates;
+  for (unsigned i = 0; i < 50; i++) {
+    candidates.push_back(obindex2::ImageMatch(i * 3, 1.0 - i * 0.01));
+  }
+
+  GuidedMatchingGrid grid;
+  IslandBuilder builder;
+  std::vector<cv::DMatch> matches;
+  std::vector<Island> islands;
+  size_t count = 0;
+  for (unsigned run = 0; run < 2; run++) {
+    // The first run grows the buffers
+    if (run == 1) {
+      count = numAllocations();
+    }
+    ratioMatchHamming(query, train, 0.8f, BF_MATCHER_SCALAR, &matches);
+    EXPECT_FALSE(matches.empty());
+    guidedRatioMatchHamming(query, pts, train, pts, 40.0f, 0.8f, &grid,
+                            &matches);
+    EXPECT_FALSE(matches.empty());
+    builder.build(candidates, 3, nullptr, &islands);
+    EXPECT_FALSE(islands.empty());
+  }
+  EXPECT_EQ(count, numAllocations());
+}
+
+TEST(Allocations, SubmittingSmallJobsDoesNotAllocate) {
+  std::atomic<unsigned> njobs(0);
+  size_t count;
+  {
+    WorkerThread worker(2);
+    count = numAllocations();
+    for (unsigned i = 0; i < 100; i++) {
+      worker.submit([&njobs]() { njobs++; });
+    }
+    worker.wait();
+    EXPECT_EQ(count, numAllocations());
+  }
+  EXPECT_EQ(100u, njobs.load());
+}
+
+}  // namespace ibow_lcd
@@ -0,0 +1,119 @@
+/*
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <limits>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "ibow-lcd/hamming_matcher.h"
+
+namespace ibow_lcd {
+
+namespace {
+
+// Random descriptors spread over an image
+void randomFeatures(const unsigned n,
+                    std::mt19937* rng,
+                    std::vector<cv::Point2f>* pts,
+                    cv::Mat* descs) {
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::uniform_real_distribution<float> coord(0.0f, 640.0f);
+  pts->resize(n);
+  *descs = cv::Mat(n, 32, CV_8U);
+  for (unsigned i = 0; i < n; i++) {
+    (*pts)[i] = cv::Point2f(coord(*rng), coord(*rng));
+    for (int b = 0; b < 32; b++) {
+      descs->at<uchar>(i, b) = static_cast<uchar>(byte(*rng));
+    }
+  }
+}
+
+}  // namespace
+
+TEST(HammingMatcher, GuidedMatchingWithALargeRadiusIsBruteForce) {
+  std::mt19937 rng(7);
+  std::vector<cv::Point2f> pts;
+  cv::Mat train;
+  randomFeatures(200, &rng, &pts, &train);
+  cv::Mat query = train.clone();
+  for (int i = 0; i < query.rows; i++) {
+    query.at<uchar>(i, i % 32) ^= 1;
+  }
+
+  std::vector<cv::DMatch> expected;
+  ratioMatchHamming(query, train, 0.8f, BF_MATCHER_SCALAR, &expected);
+  ASSERT_EQ(200u, expected.size());
+
+  GuidedMatchingGrid grid;
+  const float radii[] = {1000.0f, 1e30f};
+  for (float radius : radii) {
+    std::vector<cv::DMatch> matches;
+    guidedRatioMatchHamming(query, pts, train, pts, radius, 0.8f, &grid,
+                            &matches);
+    ASSERT_EQ(expected.size(), matches.size());
+    for (unsigned i = 0; i < matches.size(); i++) {
+      EXPECT_EQ(expected[i].queryIdx, matches[i].queryIdx);
+      EXPECT_EQ(expected[i].trainIdx, matches[i].trainIdx);
+    }
+  }
+}
+
+TEST(HammingMatcher, GuidedMatchingBoundsTheGrid) {
+  std::mt19937 rng(7);
+  std::vector<cv::Point2f> pts;
+  cv::Mat train;
+  randomFeatures(200, &rng, &pts, &train);
+
+  // A cell per radius would be a grid of 10^16 cells
+  GuidedMatchingGrid grid;
+  std::vector<cv::DMatch> matches;
+  guidedRatioMatchHamming(train, pts, train, pts, 1e-5f, 0.8f, &grid,
+                          &matches);
+  EXPECT_TRUE(matches.empty());
+  EXPECT_GE(64u * 64u + 1u, grid.cell_start.size());
+}
+
+TEST(HammingMatcher, GuidedMatchingSkipsInvalidPredictions) {
+  std::mt19937 rng(7);
+  std::vector<cv::Point2f> pts;
+  cv::Mat train;
+  randomFeatures(200, &rng, &pts, &train);
+
+  std::vector<cv::Point2f> predicted = pts;
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  const float inf = std::numeric_limits<float>::infinity();
+  predicted[0] = cv::Point2f(nan, 10.0f);
+  predicted[1] = cv::Point2f(10.0f, inf);
+  predicted[2] = cv::Point2f(-inf, -inf);
+  predicted[3] = cv::Point2f(1e30f, -1e30f);
+
+  GuidedMatchingGrid grid;
+  std::vector<cv::DMatch> matches;
+  guidedRatioMatchHamming(train, predicted, train, pts, 1000.0f, 0.8f, &grid,
+                          &matches);
+  ASSERT_EQ(196u, matches.size());
+  for (unsigned i = 0; i < matches.size(); i++) {
+    EXPECT_EQ(static_cast<int>(i) + 4, matches[i].queryIdx);
+    EXPECT_EQ(matches[i].queryIdx, matches[i].trainIdx);
+  }
+}
+
+}  // namespace ibow_lcd
@@ -0,0 +1,53 @@
+/*
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "ibow-lcd/keyframe_store.h"
+
+namespace ibow_lcd {
+
+TEST(KeyframeStore, CopiesTheDescriptors) {
+  KeyframeStore store;
+  std::vector<cv::Point2f> pts(4, cv::Point2f(1.0f, 2.0f));
+  cv::Mat descs = cv::Mat::zeros(4, 32, CV_8U);
+  for (int i = 0; i < descs.rows; i++) {
+    descs.at<unsigned char>(i, i) = 255;
+  }
+
+  std::shared_ptr<const Keyframe> kf = store.add(0, pts, descs);
+
+  // The caller reuses its buffer for the next image
+  for (int i = 0; i < descs.rows; i++) {
+    descs.at<unsigned char>(i, i) = 0;
+  }
+
+  std::shared_ptr<const Keyframe> stored = store.get(0);
+  ASSERT_TRUE(stored != nullptr);
+  EXPECT_EQ(kf, stored);
+  ASSERT_EQ(4, stored->descs.rows);
+  for (int i = 0; i < stored->descs.rows; i++) {
+    EXPECT_EQ(255, stored->descs.at<unsigned char>(i, i));
+  }
+}
+
+}  // namespace ibow_lcd
@@ -0,0 +1,344 @@
+/*
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "ibow-lcd/lcdetector.h"
+#include "synthetic_sequence.h"
+
+namespace ibow_lcd {
+
+namespace {
+
+LCDetectorParams testParams() {
+  LCDetectorParams params;
+  params.p = 5;
+  params.min_consecutive_loops = 100;  // Every loop is verified
+  return params;
+}
+
+// A sequence through the given places, followed by a second visit to some of
+// them
+void loopSequence(const SyntheticSequence& seq,
+                  const unsigned first_revisit,
+                  const unsigned last_revisit,
+                  std::vector<unsigned>* image_ids,
+                  std::vector<std::vector<cv::KeyPoint> >* kps,
+                  std::vector<cv::Mat>* descs) {
+  std::vector<std::pair<unsigned, unsigned> > frames;
+  for (unsigned i = 0; i < seq.numPlaces(); i++) {
+    frames.push_back(std::make_pair(i, 0));
+  }
+  for (unsigned i = first_revisit; i <= last_revisit; i++) {
+    frames.push_back(std::make_pair(i, 1));
+  }
+
+  image_ids->resize(frames.size());
+  kps->resize(frames.size());
+  descs->resize(frames.size());
+  for (unsigned i = 0; i < frames.size(); i++) {
+    (*image_ids)[i] = i;
+    seq.frame(frames[i].first, frames[i].second, &(*kps)[i], &(*descs)[i]);
+  }
+}
+
+void processSequence(const LCDetectorParams& params,
+                     const std::vector<unsigned>& image_ids,
+                     const std::vector<std::vector<cv::KeyPoint> >& kps,
+                     const std::vector<cv::Mat>& descs,
+                     std::vector<LCDetectorResult>* results) {
+  LCDetector lcdet(params);
+  results->resize(image_ids.size());
+  for (unsigned i = 0; i < image_ids.size(); i++) {
+    lcdet.process(image_ids[i], kps[i], descs[i], &(*results)[i]);
+  }
+}
+
+void expectSameResults(const std::vector<LCDetectorResult>& expected,
+                       const std::vector<LCDetectorResult>& actual) {
+  ASSERT_EQ(expected.size(), actual.size());
+  for (unsigned i = 0; i < expected.size(); i++) {
+    EXPECT_EQ(expected[i].status, actual[i].status) << "image " << i;
+    EXPECT_EQ(expected[i].train_id, actual[i].train_id) << "image " << i;
+    EXPECT_EQ(expected[i].inliers, actual[i].inliers) << "image " << i;
+    EXPECT_EQ(expected[i].cand_ids, actual[i].cand_ids) << "image " << i;
+    EXPECT_EQ(expected[i].cand_inliers, actual[i].cand_inliers)
+                                                          << "image " << i;
+  }
+}
+
+}  // namespace
+
+TEST(LCDetector, SkipsRedundantFrames) {
+  const unsigned nplaces = 12;
+  const unsigned nvisits = 3;
+  SyntheticSequence seq(nplaces, 100);
+  LCDetectorParams params = testParams();
+  params.redundancy_ratio = 0.5f;
+  LCDetector lcdet(params);
+
+  // Several consecutive frames of each place. Only the first one is indexed,
+  // so the index ids skip the others.
+  std::vector<cv::KeyPoint> kps;
+  cv::Mat descs;
+  LCDetectorResult result;
+  unsigned image_id = 0;
+  for (unsigned i = 0; i < nplaces; i++) {
+    for (unsigned v = 0; v < nvisits; v++) {
+      seq.frame(i, v, &kps, &descs);
+      lcdet.process(image_id++, kps, descs, &result);
+    }
+  }
+
+  // Revisiting the places indexed so far
+  for (unsigned i = 0; i < nplaces - 2; i++) {
+    seq.frame(i, nvisits, &kps, &descs);
+    lcdet.process(image_id++, kps, descs, &result);
+    ASSERT_EQ(LC_DETECTED, result.status) << "place " << i;
+    EXPECT_EQ(i * nvisits, result.train_id);
+  }
+
+  for (unsigned v = 0; v < nvisits; v++) {
+    EXPECT_EQ(nvisits, lcdet.representative(nvisits + v));
+  }
+}
+
+TEST(LCDetector, ReuseQuerySearchFindsTheSameLoops) {
+  SyntheticSequence seq(30, 100);
+  std::vector<unsigned> image_ids;
+  std::vector<std::vector<cv::KeyPoint> > kps;
+  std::vector<cv::Mat> descs;
+  loopSequence(seq, 0, 20, &image_ids, &kps, &descs);
+
+  // The words of the last p images take part in the search of an image, so
+  // the results are only the same when those images are not alike, as here.
+  // reuse_query_search.json compares both modes on a real sequence.
+  LCDetectorParams params = testParams();
+  std::vector<LCDetectorResult> expected;
+  processSequence(params, image_ids, kps, descs, &expected);
+  params.reuse_query_search = true;
+  std::vector<LCDetectorResult> results;
+  processSequence(params, image_ids, kps, descs, &results);
+  expectSameResults(expected, results);
+  for (unsigned i = 30; i < image_ids.size(); i++) {
+    EXPECT_EQ(LC_DETECTED, results[i].status) << "image " << i;
+  }
+}
+
+TEST(LCDetector, ForgettingIsReproducible) {
+  SyntheticSequence seq(40, 100);
+  std::vector<unsigned> image_ids;
+  std::vector<std::vector<cv::KeyPoint> > kps;
+  std::vector<cv::Mat> descs;
+  loopSequence(seq, 26, 34, &image_ids, &kps, &descs);
+
+  LCDetectorParams params = testParams();
+  params.forget_policy = FORGET_OLDEST;
+  params.max_indexed_images = 12;
+  params.forget_step = 6;
+
+  // The recent places are still indexed, so their loops are found
+  std::vector<LCDetectorResult> results;
+  processSequence(params, image_ids, kps, descs, &results);
+  for (unsigned i = 40; i < image_ids.size(); i++) {
+    ASSERT_EQ(LC_DETECTED, results[i].status) << "image " << i;
+    EXPECT_EQ(i - 40 + 26, results[i].train_id);
+  }
+
+  // The index is replaced at the same images whatever the time it takes to
+  // rebuild it, so the results are always the same
+  for (unsigned run = 0; run < 3; run++) {
+    std::vector<LCDetectorResult> rerun;
+    processSequence(params, image_ids, kps, descs, &rerun);
+    expectSameResults(results, rerun);
+  }
+
+  // Searching the sequence and replaying the searches too
+  LCDetector searcher(params);
+  std::vector<LCDetectorSearch> searches(image_ids.size());
+  for (unsigned i = 0; i < image_ids.size(); i++) {
+    searcher.search(image_ids[i], kps[i], descs[i], &searches[i]);
+  }
+  LCDetector replayer(params);
+  std::vector<LCDetectorResult> replayed(image_ids.size());
+  for (unsigned i = 0; i < image_ids.size(); i++) {
+    replayer.replay(image_ids[i], kps[i], descs[i], searches[i],
+                    &replayed[i]);
+  }
+  expectSameResults(results, replayed);
+}
+
+TEST(LCDetector, BatchesFindTheSameLoops) {
+  LCDetectorParams params = testParams();
+  params.batch_size = 8;
+  LCDetectorParams forgetting = params;
+  forgetting.forget_policy = FORGET_OLDEST;
+  forgetting.max_indexed_images = 12;
+  forgetting.forget_step = 6;
+  LCDetectorParams dropping = params;
+  dropping.kf_budget = 1;
+
+  // Larger frames for the keyframes to exceed the budget
+  SyntheticSequence seq(40, 100);
+  SyntheticSequence large_seq(40, 500);
+  const SyntheticSequence* seqs[] = {&seq, &seq, &large_seq};
+  const LCDetectorParams configs[] = {params, forgetting, dropping};
+
+  for (unsigned c = 0; c < 3; c++) {
+    std::vector<unsigned> image_ids;
+    std::vector<std::vector<cv::KeyPoint> > kps;
+    std::vector<cv::Mat> descs;
+    loopSequence(*seqs[c], 10, 34, &image_ids, &kps, &descs);
+
+    std::vector<LCDetectorResult> expected;
+    processSequence(configs[c], image_ids, kps, descs, &expected);
+    LCDetector lcdet(configs[c]);
+    std::vector<LCDetectorResult> results;
+    lcdet.processBatch(image_ids, kps, descs, &results);
+    SCOPED_TRACE("config " + std::to_string(c));
+    expectSameResults(expected, results);
+  }
+}
+
+TEST(LCDetector, ReportsTheIslandsUpToTheAcceptedOne) {
+  SyntheticSequence seq(30, 100);
+  std::vector<unsigned> image_ids;
+  std::vector<std::vector<cv::KeyPoint> > kps;
+  std::vector<cv::Mat> descs;
+  loopSequence(seq, 0, 20, &image_ids, &kps, &descs);
+
+  LCDetectorParams params = testParams();
+  params.max_verified_islands = 4;
+  std::vector<LCDetectorResult> results;
+  processSequence(params, image_ids, kps, descs, &results);
+
+  unsigned nverified = 0;
+  for (unsigned i = 0; i < results.size(); i++) {
+    const LCDetectorResult& result = results[i];
+    ASSERT_EQ(result.cand_ids.size(), result.cand_inliers.size());
+    if (result.cand_ids.empty()) {
+      continue;
+    }
+
+    // Every island but the last one has been rejected
+    nverified++;
+    for (unsigned j = 0; j + 1 < result.cand_inliers.size(); j++) {
+      EXPECT_LE(result.cand_inliers[j], params.min_inliers) << "image " << i;
+    }
+    if (result.status == LC_DETECTED) {
+      EXPECT_EQ(result.cand_ids.back(), result.train_id) << "image " << i;
+      EXPECT_EQ(result.cand_inliers.back(), result.inliers) << "image " << i;
+    } else {
+      EXPECT_LE(result.cand_inliers.back(), params.min_inliers)
+                                                          << "image " << i;
+    }
+  }
+  EXPECT_LT(0u, nverified);
+
+  // The candidates verified concurrently do not change the result
+  for (unsigned run = 0; run < 3; run++) {
+    std::vector<LCDetectorResult> rerun;
+    processSequence(params, image_ids, kps, descs, &rerun);
+    expectSameResults(results, rerun);
+  }
+}
+
+TEST(LCDetector, ResumesFromASnapshot) {
+  SyntheticSequence seq(30, 100);
+  std::vector<unsigned> image_ids;
+  std::vector<std::vector<cv::KeyPoint> > kps;
+  std::vector<cv::Mat> descs;
+  loopSequence(seq, 0, 20, &image_ids, &kps, &descs);
+
+  LCDetectorParams params = testParams();
+  params.snapshots = true;
+  std::vector<LCDetectorResult> expected;
+  processSequence(params, image_ids, kps, descs, &expected);
+
+  // The detector that saved the snapshot is gone when the loaded one runs
+  const std::string filename = "test_lcdetector_snapshot.bin";
+  const unsigned nsaved = 35;
+  std::vector<LCDetectorResult> results(image_ids.size());
+  {
+    LCDetector lcdet(params);
+    for (unsigned i = 0; i < nsaved; i++) {
+      lcdet.process(image_ids[i], kps[i], descs[i], &results[i]);
+    }
+    ASSERT_TRUE(lcdet.save(filename));
+  }
+  EXPECT_FALSE(std::ifstream(filename + ".tmp").good());
+
+  LCDetector resumed(params);
+  ASSERT_TRUE(resumed.load(filename));
+  std::remove(filename.c_str());
+  for (unsigned i = nsaved; i < image_ids.size(); i++) {
+    resumed.process(image_ids[i], kps[i], descs[i], &results[i]);
+  }
+
+  // The trees of the index may split differently once it is replayed, so
+  // only the loops are compared
+  for (unsigned i = nsaved; i < image_ids.size(); i++) {
+    ASSERT_EQ(LC_DETECTED, expected[i].status) << "image " << i;
+    EXPECT_EQ(expected[i].status, results[i].status) << "image " << i;
+    EXPECT_EQ(expected[i].train_id, results[i].train_id) << "image " << i;
+  }
+}
+
+TEST(LCDetector, RejectsSnapshotsOfOtherParams) {
+  SyntheticSequence seq(10, 100);
+  std::vector<cv::KeyPoint> kps;
+  cv::Mat descs;
+  LCDetectorResult result;
+
+  LCDetectorParams params = testParams();
+  params.snapshots = true;
+  const std::string filename = "test_lcdetector_params.bin";
+  {
+    LCDetector lcdet(params);
+    for (unsigned i = 0; i < seq.numPlaces(); i++) {
+      seq.frame(i, 0, &kps, &descs);
+      lcdet.process(i, kps, descs, &result);
+    }
+    ASSERT_TRUE(lcdet.save(filename));
+  }
+
+  std::vector<LCDetectorParams> others(5, params);
+  others[0].k = 8;
+  others[1].purge_descriptors = false;
+  others[2].nndr = 0.7f;
+  others[3].redundancy_ratio = 0.5f;
+  others[4].forget_policy = FORGET_OLDEST;
+  others[4].max_indexed_images = 100;
+  for (unsigned i = 0; i < others.size(); i++) {
+    LCDetector lcdet(others[i]);
+    EXPECT_FALSE(lcdet.load(filename)) << "params " << i;
+  }
+
+  LCDetector lcdet(params);
+  EXPECT_TRUE(lcdet.load(filename));
+  std::remove(filename.c_str());
+}
+
+}  // namespace ibow_lcd
@@ -0,0 +1,99 @@
+/*
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "ibow-lcd/lcdetector.h"
+#include "synthetic_sequence.h"
+
+namespace ibow_lcd {
+
+TEST(LCDetectorQuery, RunsWhileProcessing) {
+  const unsigned nplaces = 40;
+  const unsigned nreaders = 4;
+  SyntheticSequence seq(nplaces, 100);
+  LCDetectorParams params;
+  params.p = 5;
+  LCDetector lcdet(params);
+
+  // Indexing the first places before querying them
+  const unsigned nindexed = 10;
+  std::vector<cv::KeyPoint> kps;
+  cv::Mat descs;
+  LCDetectorResult result;
+  for (unsigned i = 0; i < nindexed + params.p - 1; i++) {
+    seq.frame(i, 0, &kps, &descs);
+    lcdet.process(i, kps, descs, &result);
+  }
+
+  // Readers relocalize revisits of the indexed places while the rest of the
+  // sequence is processed
+  std::atomic<bool> stop(false);
+  std::atomic<unsigned> nfailed(0);
+  std::vector<unsigned> nqueries(nreaders, 0);
+  std::vector<std::thread> readers;
+  for (unsigned r = 0; r < nreaders; r++) {
+    readers.push_back(std::thread([&, r]() {
+      std::vector<cv::KeyPoint> qkps;
+      cv::Mat qdescs;
+      LCDetectorResult qresult;
+      for (unsigned q = r; !stop || nqueries[r] < 2; q++) {
+        unsigned place = q % nindexed;
+        seq.frame(place, 1, &qkps, &qdescs);
+        lcdet.query(qkps, qdescs, &qresult);
+        if (qresult.status != LC_DETECTED || qresult.train_id != place) {
+          nfailed++;
+        }
+        nqueries[r]++;
+      }
+    }));
+  }
+
+  for (unsigned i = nindexed + params.p - 1; i < nplaces; i++) {
+    seq.frame(i, 0, &kps, &descs);
+    lcdet.process(i, kps, descs, &result);
+  }
+  stop = true;
+  for (unsigned r = 0; r < nreaders; r++) {
+    readers[r].join();
+  }
+
+  EXPECT_EQ(0u, nfailed.load());
+
+  // Queries do not modify the detector
+  std::vector<LCDetectorResult> results;
+  LCDetector alone(params);
+  for (unsigned i = 0; i < nplaces; i++) {
+    seq.frame(i, 0, &kps, &descs);
+    alone.process(i, kps, descs, &result);
+  }
+  seq.frame(3, 1, &kps, &descs);
+  LCDetectorResult expected;
+  alone.query(kps, descs, &expected);
+  lcdet.query(kps, descs, &result);
+  EXPECT_EQ(expected.status, result.status);
+  EXPECT_EQ(expected.train_id, result.train_id);
+  EXPECT_EQ(expected.inliers, result.inliers);
+}
+
+}  // namespace ibow_lcd
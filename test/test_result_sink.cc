@@ -0,0 +1,71 @@
+/*
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "ibow-lcd/result_sink.h"
+
+namespace ibow_lcd {
+
+namespace {
+
+unsigned countLines(const std::string& filename) {
+  std::ifstream in(filename);
+  std::string line;
+  unsigned nlines = 0;
+  while (std::getline(in, line)) {
+    nlines++;
+  }
+  return nlines;
+}
+
+}  // namespace
+
+TEST(TsvSink, WritesInBlocks) {
+  const std::string filename = "test_result_sink.txt";
+  LCDetectorResult result;
+  LCDetectorTrace trace;
+  {
+    TsvSink sink(filename, 4);
+    for (unsigned i = 0; i < 10; i++) {
+      trace.img_id = i;
+      sink.write(result, trace);
+    }
+
+    // Two full blocks were written, the last two lines are still buffered
+    EXPECT_EQ(8u, countLines(filename));
+  }
+  EXPECT_EQ(10u, countLines(filename));
+
+  std::ifstream in(filename);
+  unsigned min_id, max_id, img_id;
+  for (unsigned i = 0; i < 10; i++) {
+    ASSERT_TRUE(in >> min_id >> max_id >> img_id);
+    EXPECT_EQ(i, img_id);
+    std::string rest;
+    std::getline(in, rest);
+  }
+  std::remove(filename.c_str());
+}
+
+}  // namespace ibow_lcd
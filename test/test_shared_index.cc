@@ -0,0 +1,88 @@
+/*
+* This file is part of ibow-lcd.
+*
+* Copyright (C) 2017 Emilio Garcia-Fidalgo <emilio.garcia@uib.es> (University of the Balearic Islands)
+*
+* ibow-lcd is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ibow-lcd is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ibow-lcd. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "ibow-lcd/lcdetector.h"
+#include "ibow-lcd/shared_index.h"
+#include "synthetic_sequence.h"
+
+namespace ibow_lcd {
+
+namespace {
+
+LCDetectorParams testParams() {
+  LCDetectorParams params;
+  params.p = 5;
+  params.min_consecutive_loops = 100;  // Every loop is verified
+  return params;
+}
+
+}  // namespace
+
+TEST(SharedIndex, FindsLoopsBetweenSessions) {
+  const unsigned nplaces = 20;
+  SyntheticSequence seq(nplaces, 100);
+  LCDetectorParams params = testParams();
+  std::shared_ptr<SharedIndex> shared = std::make_shared<SharedIndex>(params);
+
+  params.session_id = 0;
+  LCDetector first(params, shared);
+  params.session_id = 1;
+  LCDetector second(params, shared);
+
+  std::vector<cv::KeyPoint> kps;
+  cv::Mat descs;
+  LCDetectorResult result;
+  for (unsigned i = 0; i < nplaces; i++) {
+    seq.frame(i, 0, &kps, &descs);
+    first.process(i, kps, descs, &result);
+  }
+
+  // The second session revisits the places already indexed by the first one.
+  // Its images are searched against the ones of both sessions.
+  const unsigned nrevisits = nplaces - params.p + 1;
+  unsigned nloops = 0;
+  for (unsigned i = 0; i < nrevisits; i++) {
+    seq.frame(i, 1, &kps, &descs);
+    second.process(i, kps, descs, &result);
+    EXPECT_EQ(sessionImageId(1, i), result.query_id);
+    if (i + 1 < params.p) {
+      EXPECT_EQ(LC_NOT_ENOUGH_IMAGES, result.status);
+      continue;
+    }
+
+    ASSERT_EQ(LC_DETECTED, result.status) << "image " << i;
+    EXPECT_EQ(0u, result.train_session);
+    EXPECT_EQ(sessionImageId(0, i), result.train_id);
+    nloops++;
+  }
+  EXPECT_EQ(nrevisits - params.p + 1, nloops);
+
+  // Relocalization against both sessions
+  seq.frame(3, 2, &kps, &descs);
+  second.query(kps, descs, &result);
+  EXPECT_EQ(LC_DETECTED, result.status);
+  EXPECT_EQ(3u, localImageId(result.train_id));
+}
+
+}  // namespace ibow_lcd